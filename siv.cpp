@@ -6,7 +6,7 @@
 //              In verification mode, the program will verify the integrity of the directory against a verification file.
 //              The program can also generate a report file that contains the results of the verification.
 // Dependencies: Crypto++ library, C++20, g++ compiler
-// compile: g++ -std=c++20 -o siv SIV.cpp -l cryptopp
+// compile: g++ -std=c++20 -o siv SIV.cpp -l cryptopp -pthread
 // run: ./siv -h
 
 #include <iostream>
@@ -23,6 +23,41 @@
 #include <sstream>
 #include <chrono>
 #include <ctime>
+#include <map>
+#include <algorithm>
+#include <numeric>
+#include <cstring>
+#include <cstddef>
+#include <cmath>
+#include <dirent.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/file.h>
+#include <sys/resource.h>
+#include <sys/sysmacros.h>
+#include <sched.h>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <coroutine>
+#include <deque>
+#include <queue>
+#include <random>
+#include <charconv>
+#include <array>
+#include <memory>
+#include <string_view>
+#ifdef __x86_64__
+#include <immintrin.h>
+#endif
+#include <linux/fs.h>
+#include <linux/fiemap.h>
+#include <linux/ioprio.h>
+#include <sys/syscall.h>
 
 // Crypto++ library
 #define CRYPTOPP_ENABLE_NAMESPACE_WEAK 1
@@ -36,25 +71,496 @@ using namespace std;
 namespace fs = filesystem;
 namespace crp = CryptoPP;
 
-// used to convert a std::filesystem::file_time_type to a string
-// source:https://stackoverflow.com/questions/56788745/how-to-convert-stdfilesystemfile-time-type-to-a-string-using-gcc-9
-template <typename TP>
-std::time_t to_time_t(TP tp)
+struct passwd *pw;
+
+// the largest message digest in bytes (sha1)
+const size_t MAX_DIGEST_SIZE = 20;
+
+// an entry of the monitored directory.
+// only the fields of the stat info that are written to the verification file or needed to schedule
+// and cache the reads are kept (symbolic links are followed)
+struct ScanEntry
 {
-    using namespace std::chrono;
-    auto sctp = time_point_cast<system_clock::duration>(tp - TP::clock::now() + system_clock::now());
-    return system_clock::to_time_t(sctp);
-}
+    string path;                     // full path of the file or directory
+    uint64_t size;                   // file size
+    int64_t mtime;                   // last modification time in seconds
+    uint32_t mtimeNsec;              // nanoseconds of the last modification time
+    int64_t ctimeNs;                 // last status change time in nanoseconds
+    uint64_t dev;                    // device of the file
+    uint64_t ino;                    // inode number of the file
+    uint32_t uid;                    // owner of the file
+    uint32_t mode;                   // file type and access rights
+    uint32_t nlink;                  // number of hard links
+    bool isDirectory;                // true if the entry is a directory (or a link to one)
+    bool changed = false;            // true if a field cheaper than the digest differs from the verification file
+    uint8_t digestSize = 0;          // size of the message digest of the file (0 if it was not computed)
+    uint8_t digest[MAX_DIGEST_SIZE]; // the binary message digest of the file
+    int readError = 0;               // errno of a read of the file that failed (0 if it was read or not hashed)
+};
 
-struct stat info;
-struct passwd *pw;
-struct group *gr;
+// default size of the hash cache file in bytes
+const uint64_t HASH_CACHE_DEFAULT_SIZE = 64 << 20;
+
+// options that change the way the monitored directory is scanned
+struct ScanOptions
+{
+    bool inodeOrder = false;                          // stat entries in inode order and read files in physical extent order
+    string hashCachePath;                             // path of the hash cache file (empty if no cache is used)
+    uint64_t hashCacheSize = HASH_CACHE_DEFAULT_SIZE; // maximum size of the hash cache file in bytes
+    unsigned jobs = 0;                                // number of hashing threads (0 to size it from the cpu limit)
+    bool background = false;                          // yield to other processes when the host is under pressure
+    double maxPressure = 10;                          // share of stalled time (in percent) above which the scan yields
+    uint64_t maxReadRate = 0;                         // maximum number of bytes read per second (0 for no limit)
+    double maxCpu = 0;                                // maximum number of cpus used by the hashing threads (0 for no limit)
+    bool idleIo = false;                              // use the idle io priority class
+    string pageCache = "keep";                        // keep, drop or direct: what happens to the pages of the files read
+    bool cacheFirst = false;                          // hash the files in the page cache first and prefetch the others
+    int prefetch = 0;                                 // number of files prefetched ahead of the hashing threads (-1: auto)
+    unsigned deviceReaders = 0;                       // number of files read from one device at the same time (0: auto)
+    bool autotune = false;                            // tune the hashing threads and device readers from the throughput
+    bool largestFirst = false;                        // hash the large files in decreasing size order first
+    uint64_t reorderBuffer = 0;                       // maximum size of the lines waiting to be written (0: auto)
+    unsigned async = 0;                               // number of files in flight in the coroutine executor (0: thread per file)
+    string changedHash = "defer";                     // compute, defer or skip: when changed files are hashed in verification
+    uint64_t memoryBudget = 0;                        // memory for the scanned entries in verification, spilled to run files beyond it (0: no limit)
+    uint64_t maxMemory = 0;                           // memory limit that siv keeps to by itself (0: the limit of the host or cgroup)
+};
+ScanOptions scanOptions;
+
+// per-directory information kept in the verification file, so that unchanged directories need not be listed again
+struct DirRecord
+{
+    string path;       // path of the directory (without trailing separator)
+    uint64_t ino;      // inode number of the directory
+    int64_t mtimeNs;   // last modification time in nanoseconds
+    int64_t ctimeNs;   // last status change time in nanoseconds
+    size_t childCount; // number of entries in the directory
+};
+
+// state shared by all directories of a walk
+struct WalkState
+{
+    map<string, DirRecord> known;              // directory records read from the verification file
+    map<string, vector<string>> knownChildren; // names of the entries of the known directories
+    vector<DirRecord> records;                 // records of the directories listed during the walk
+    int reused = 0;                            // number of directories whose recorded listing was reused
+    atomic<bool> knownReady = true;            // false while the directory records are still being loaded
+    function<void(vector<ScanEntry> &)> spill; // takes the entries walked so far once they exceed spillBytes (may be empty)
+    uint64_t spillBytes = 0;                   // memory of the walked entries after which they are spilled
+    uint64_t walkedBytes = 0;                  // memory of the entries walked since the last spill
+};
+
+// the entries of a verification file, stored column by column.
+// the paths are stored one after the other in an arena, the other fields as typed values
+// (the names of owners and groups are stored once and referred to by their index)
+struct EntryTable
+{
+    string arena;                     // the paths of the entries, one after the other
+    vector<uint64_t> pathEnd;         // end of the path of each entry in the arena
+    vector<uint64_t> size;            // file size
+    vector<int64_t> mtime;            // last modification time in seconds
+    vector<uint16_t> mode;            // access rights
+    vector<uint32_t> owner;           // name of the owner
+    vector<uint32_t> group;           // name of the group
+    vector<char> isDirectory;         // true for directories, which have no digest
+    bool legacyTimes = false;         // true if the whole-second modification times were written one second early
+    size_t digestSize;                // size of the message digests in bytes
+    vector<uint8_t> digests;          // the message digests of the files, digestSize bytes per entry
+    vector<string> names;             // the names of owners and groups
+    map<string, uint32_t, less<>> nameIndex; // key: name, value: index in names
+    uint64_t seed;                    // random key of the path hashes, so that no paths can be chosen to collide
+};
+
+// a shard of a path index: an open-addressing hash table of rows of the entry table, probed linearly
+struct PathShard
+{
+    mutex lock;             // held while the shard is inserted into or searched
+    vector<uint32_t> slots; // row of the entry table + 1 (0 for empty slots), the size is a power of two
+    size_t used = 0;        // number of slots that are not empty
+};
+
+// an index from the paths of an entry table to their rows, split into shards so that many threads
+// can insert into it at once. a row is marked as seen when the scan finds its path, the rows that are
+// not seen after the scan are deleted
+struct PathIndex
+{
+    unique_ptr<PathShard[]> shards;  // the shards, chosen by the high bits of the hash of a path
+    unique_ptr<atomic<bool>[]> seen; // true for the rows whose path was found by the scan
+};
+
+// number of shards of a path index (a power of two)
+const int PATH_INDEX_SHARD_BITS = 6;
+
+// a range of entries processed by one thread in verification has at least this many entries
+const size_t PARTITION_MIN = 1 << 16;
+
+// number of scanned entries compared together once their lines have left the reorder buffer
+const size_t COMPARE_RANGE = 1 << 12;
+
+// the part of the verification file parsed by one thread is at least this large
+const size_t PARSE_CHUNK_MIN = 1 << 20;
+
+// the first line of the verification file. the files of earlier releases have the title without
+// format number, and their whole-second modification times were written one second early
+// (the time between two clock reads was subtracted from them)
+const string VERIFICATION_FILE_TITLE = "SIV Verification File 2";
+const string LEGACY_FILE_TITLE = "SIV Verification File";
+const uint32_t LEGACY_TIME_SKEW_NS = 1000000;
+
+// a directory is only recorded if its last change is this much older than the listing.
+// changes within the timestamp granularity of the file system could otherwise go unnoticed
+const int64_t SETTLE_TIME_NS = 2000000000;
+
+// a slot of the hash cache.
+// a file is identified by device, inode, size, modification and status change time:
+// the content of a file can not change without changing its status change time
+struct HashCacheSlot
+{
+    uint64_t dev;       // device of the file
+    uint64_t ino;       // inode number of the file
+    uint64_t size;      // size of the file
+    int64_t mtimeNs;    // last modification time in nanoseconds
+    int64_t ctimeNs;    // last status change time in nanoseconds
+    uint32_t lastUsed;  // run in which the slot was last used, the least recently used slot is evicted first
+    uint8_t hashId;     // hash function of the digest (0 for empty slots)
+    uint8_t digestSize; // size of the digest in bytes
+    uint8_t digest[20]; // the message digest
+    uint64_t check;     // checksum of the fields above, detects slots torn by a crashed run
+};
+
+// the header at the start of the hash cache file
+struct HashCacheHeader
+{
+    char magic[8];      // "SIVHC01" with terminating zero
+    uint64_t slotCount; // number of slots following the header
+    uint32_t run;       // number of runs that used the cache
+};
+
+// persistent cache of message digests, shared by all verification files and runs.
+// the cache file is a fixed size open addressing hash table that is mapped into memory
+struct HashCache
+{
+    int fd = -1;             // file descriptor of the cache file (-1 if no cache is used)
+    HashCacheHeader *header; // the mapped header
+    HashCacheSlot *slots;    // the mapped slots
+    uint64_t mappedSize;     // size of the mapping in bytes
+    uint32_t run;            // number of the current run
+    int64_t settledBefore;   // only files whose status changed before this time (in nanoseconds) are stored
+    uint64_t hits = 0;       // number of digests found in the cache
+    uint64_t misses = 0;     // number of digests that had to be computed
+    bool busy = false;       // true if the cache file was locked by another run
+    mutex lock;              // serializes the updates of the hashing threads
+};
+HashCache hashCache;
+
+// statistics of a scan that are written to the report file
+struct ScanStats
+{
+    uint64_t linkedFiles = 0;          // number of paths whose digest was taken from another hard link of the same file
+    uint64_t linkedBytes = 0;          // number of bytes that did not have to be read because of that
+    atomic<uint64_t> droppedBytes = 0; // number of bytes dropped from the page cache after hashing
+    atomic<uint64_t> directFiles = 0;  // number of files read with O_DIRECT
+    atomic<uint64_t> hashedBytes = 0;  // number of bytes read and hashed
+    uint64_t probedBytes = 0;          // number of bytes whose page cache residency was probed before hashing
+    uint64_t residentBytes = 0;        // number of those bytes that were in the page cache
+    double walkSeconds = 0;            // time spent listing and stating the monitored directory
+    double hashSeconds = 0;            // time spent hashing the files (and writing or comparing their lines)
+};
+ScanStats scanStats;
+
+// the names of the owners of the entries, so that the user database is read once per owner
+struct OwnerCache
+{
+    map<uid_t, string> users; // key: user id, value: user name
+    uint64_t lookups = 0;     // number of entries whose owner was looked up
+};
+OwnerCache owners;
+
+// number of slots searched for a file before the least recently used one is evicted
+const uint64_t HASH_CACHE_PROBES = 8;
+
+// files larger than this are hashed in decreasing size order in largest first mode
+const uint64_t LARGE_FILE_SIZE = 1 << 20;
+
+// number of files whose physical extents are looked up and sorted together in inode order mode
+const size_t EXTENT_WINDOW = 1024;
+
+// bounds of the read buffer size of a hashing thread
+const size_t MIN_READ_BUFFER = 64 << 10;
+const size_t MAX_READ_BUFFER = 1 << 20;
+
+// upper bound of the prefetched bytes waiting to be hashed
+const uint64_t MAX_PREFETCH_BYTES = 256 << 20;
+
+// upper bound of the automatically sized reorder buffer
+const uint64_t MAX_REORDER_BUFFER = 64 << 20;
+
+// the entries of a spilled scan may use half of the memory budget, the hashing of a batch the other half.
+// besides its path, an entry takes about this much memory while its batch is walked and hashed
+const uint64_t SPILL_BUDGET_SHARE = 2;
+const uint64_t SPILL_ENTRY_OVERHEAD = 128;
+
+// number of entries of a directory read and stat-ed at a time when the entries are spilled,
+// so that a large directory is spilled while it is walked
+const size_t WALK_BATCH_ENTRIES = 4096;
+
+// number of run files merged at once, more runs are merged into larger ones first
+const size_t MAX_MERGED_RUNS = 256;
+
+// the read buffers and the reorder buffer may use a 64th, the prefetched files a 16th
+// and the hash cache a quarter of the memory limit
+const uint64_t READ_BUFFER_SHARE = 64;
+const uint64_t REORDER_BUFFER_SHARE = 64;
+const uint64_t PREFETCH_SHARE = 16;
+const uint64_t HASH_CACHE_SHARE = 4;
+
+// limits of the cpus and memory available to siv (e.g. set by the cgroup of a container)
+// and the sizes of the thread pool and buffers derived from them
+struct ResourceBudget
+{
+    double cpuLimit;                         // number of cpus siv may use
+    string cpuSource;                        // where the cpu limit comes from
+    uint64_t memoryLimit;                    // number of bytes of memory siv may use
+    string memorySource;                     // where the memory limit comes from
+    unsigned workers = 1;                    // number of hashing threads in the pool
+    unsigned running = 1;                    // number of hashing threads running at the start of the scan
+    size_t readBufferSize = MAX_READ_BUFFER; // size of the read buffer of each hashing thread
+    uint64_t prefetchBytes;                  // number of prefetched bytes that may wait in the page cache to be hashed
+    uint64_t reorderBytes;                   // number of bytes of lines that may wait in the reorder buffer
+};
+ResourceBudget resources;
+
+// the parts of siv whose memory is accounted
+enum MemoryComponent
+{
+    MEM_READ_BUFFERS,
+    MEM_REORDER_BUFFER,
+    MEM_OWNER_CACHE,
+    MEM_SCANNED_ENTRIES,
+    MEM_ENTRY_TABLE,
+    MEM_PATH_INDEX,
+    MEM_COMPONENTS
+};
+const char *MEMORY_COMPONENT_NAMES[] = {"read buffers", "reorder buffer", "owner cache", "scanned entries", "entry table", "path index"};
+
+// the memory used by the components of siv and the resident memory of the process.
+// near the memory limit the scan holds back the memory it can do without (prefetching and lines hashed
+// ahead of the path order), and verification spills the scanned entries to run files
+struct MemoryAccount
+{
+    atomic<int64_t> used[MEM_COMPONENTS] = {}; // bytes used by each component
+    atomic<int64_t> peak[MEM_COMPONENTS] = {}; // most bytes used by each component at once
+    atomic<int64_t> sampledNs = 0;             // time of the last sample of the resident memory
+    atomic<bool> tight = false;                // true if the resident memory was near the limit at the last sample
+    atomic<uint64_t> tightSamples = 0;         // number of samples near the limit
+};
+MemoryAccount memory;
+
+// the resident memory is sampled at most this often (in nanoseconds)
+const int64_t MEMORY_SAMPLE_NS = 100000000;
+
+// memory is tight above this share of the limit (in percent)
+const uint64_t MEMORY_TIGHT_PERCENT = 90;
+
+// an in-memory verification needs about this many bytes per byte of the verification file
+// (the entry table, the path index and the scanned entries)
+const uint64_t VERIFY_MEMORY_FACTOR = 4;
+
+// adaptive throttling of the hashing threads in background mode.
+// a monitor thread measures the pressure stall information of the host and lets fewer threads
+// run (and thus fewer reads be in flight) while the host is under pressure
+struct Throttle
+{
+    atomic<unsigned> active;     // number of hashing threads that may run
+    mutex lock;                  // protects done and the waiting of paused threads
+    condition_variable changed;  // signalled when active or done changes
+    bool done = false;           // true when the hashing is finished
+    bool drained = false;        // true when all files were taken, so that paused threads can end
+    double throttledSeconds = 0; // time in which fewer than all hashing threads could run
+    unsigned minActive;          // smallest number of hashing threads that could run
+    bool tuned = false;          // true once the number of running threads was autotuned
+};
+Throttle throttle;
+
+// a token bucket shared by the hashing threads.
+// tokens are added at a fixed rate up to the burst size and are taken for the work already done;
+// a thread that leaves the bucket in debt waits until the debt is paid off by the refill
+struct TokenBucket
+{
+    double rate = 0;                       // tokens added per second (0 for no limit)
+    double burst;                          // maximum number of tokens
+    double tokens;                         // tokens available (negative for a debt)
+    chrono::steady_clock::time_point last; // time of the last refill
+    double waitedSeconds = 0;              // time the threads waited for tokens
+    mutex lock;                            // protects the fields above
+};
+TokenBucket readBucket; // bytes read, limited by --max-read-rate
+TokenBucket cpuBucket;  // cpu seconds used by the hashing threads, limited by --max-cpu
+
+// the burst size of the token buckets in seconds of their rate
+const double BUCKET_BURST_SECONDS = 0.1;
+
+// coordination of the prefetch thread with the hashing threads
+struct Prefetcher
+{
+    mutex lock;                      // protects done
+    condition_variable progress;     // signalled when a hashing thread takes the next file
+    bool done = false;               // true when the hashing is finished
+    atomic<unsigned> depth;          // number of uncached files that may be prefetched ahead of the hashing threads
+    unsigned maxDepth = 0;           // largest depth used
+    atomic<uint64_t> readWaitNs = 0; // time the hashing threads waited for reads
+    atomic<uint64_t> hashingNs = 0;  // time the hashing threads spent in digestFile
+};
+Prefetcher prefetcher;
+
+// the files of one device that wait to be hashed.
+// each device has its own queue and limit of files read at the same time, so that a slow device
+// can not occupy all hashing threads while the files of the fast ones wait
+struct DeviceQueue
+{
+    dev_t dev;                  // the device
+    int rotational;             // 1 for rotational disks, 0 for other block devices, -1 for other file systems
+    vector<size_t> files;       // the files of the device in schedule order (indices into the entries)
+    vector<uint64_t> coldBytes; // coldBytes[k] is the number of uncached bytes of the first k files
+    vector<size_t> coldFiles;   // coldFiles[k] is the number of uncached files among the first k files
+    atomic<size_t> next = 0;    // position of the next file to be hashed
+    unsigned readers = 0;       // number of files of the device being hashed
+    unsigned maxReaders;        // maximum number of files of the device hashed at the same time
+    size_t prefetched = 0;      // position of the next file to be prefetched
+    size_t hashed = 0;          // number of files of the device hashed by the scan (in all batches of a spilled scan)
+    bool tuned = false;         // true once maxReaders was autotuned
+};
+
+// the device queues, shared by the hashing threads
+struct Scheduler
+{
+    vector<unique_ptr<DeviceQueue>> queues; // one queue per device
+    vector<DeviceQueue *> queueOf;          // the queue of each file (indexed like the entries)
+    vector<char> taken;                     // true for the files taken by a hashing thread (indexed like the entries)
+    mutex lock;                             // protects the readers of the queues, taken and nextQueue
+    condition_variable freed;               // signalled when a hashing thread finished a file
+    size_t nextQueue = 0;                   // queue at which the search for the next file starts
+};
+Scheduler scheduler;
+
+// the last stage of a scan: the lines of the entries are passed to the sink in path order while the files are hashed
+// (written to the verification file when initializing, compared with it when verifying).
+// the line of a file that is hashed before the files preceding it waits in the buffer until they are hashed.
+// when the waiting lines exceed the size of the buffer, the hashing threads take the file that holds
+// them back next, or wait until it is hashed
+struct ReorderBuffer
+{
+    function<void(const ScanEntry &, const string &)> sink; // takes the entries and their lines in path order
+    bool withLines = true;                                   // false if the sink only takes the entries (the lines are empty)
+    vector<ScanEntry> *entries;                              // the entries in path order
+    vector<size_t> firstLink;                                // the first path of hard linked paths whose digest is copied (SIZE_MAX otherwise)
+    vector<char> complete;                                   // true for the entries whose digest is known
+    vector<string> lines;                                    // the lines of the hashed files waiting for the sink
+    size_t next = 0;                                         // index of the next entry passed to the sink
+    uint64_t bufferedBytes = 0;                              // size of the waiting lines
+    uint64_t peakBytes = 0;                                  // largest size of the waiting lines
+    size_t bufferedLines = 0;                                // number of the waiting lines
+    size_t peakLines = 0;                                    // largest number of the waiting lines
+    uint64_t headDispatches = 0;                             // number of files taken out of turn because the buffer was full
+    uint64_t stallNs = 0;                                    // time the hashing threads waited because the buffer was full
+    mutex lock;                                              // protects the fields above and the sink
+    condition_variable written;                              // signalled when lines were passed to the sink
+};
+ReorderBuffer reorder;
+
+// the coroutine executor of an async scan. each slot is a coroutine that hashes one file after the other;
+// its blocking calls (open and read) are made by the io threads, and it is resumed by one of the hashing threads
+// when they return. a few hashing threads can thus keep many files in flight, while the code of a slot reads
+// like the hashing of one file
+struct AsyncExecutor
+{
+    mutex lock;                             // protects the fields below
+    deque<coroutine_handle<>> runnable;     // slots ready to be resumed by a hashing thread
+    condition_variable resumable;           // signalled when a slot becomes runnable or the last slot ends
+    deque<function<void()>> calls;          // blocking calls waiting for an io thread
+    condition_variable called;              // signalled when a call is queued or the io threads may end
+    vector<coroutine_handle<>> parked;      // slots waiting until a file can be taken
+    uint64_t wakeups = 0;                   // number of times the parked slots were woken up
+    unsigned slots = 0;                     // number of slots that did not end
+    bool ioDone = false;                    // true when the io threads may end
+    uint64_t ioCalls = 0;                   // number of blocking calls made by the io threads
+    unsigned ioThreads = 0;                 // number of io threads
+};
+AsyncExecutor executor;
+
+// a coroutine of the async executor. it is queued as runnable when it is created and destroys itself when it ends
+struct AsyncTask
+{
+    struct promise_type
+    {
+        AsyncTask get_return_object() { return {coroutine_handle<promise_type>::from_promise(*this)}; }
+        suspend_always initial_suspend() noexcept { return {}; }
+        suspend_never final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { terminate(); }
+    };
+    coroutine_handle<promise_type> handle;
+};
+
+// number of files read from a rotational disk at the same time, more would make the heads seek between them
+const unsigned ROTATIONAL_READERS = 2;
+
+// number of files read from any other device at the same time, so that a slow device can not take every hashing thread
+const unsigned DEVICE_READERS = 8;
+
+// largest number of io threads of an async scan. without io_uring every blocking call in flight needs a thread,
+// but the io threads need neither a read buffer nor much of a stack
+const unsigned ASYNC_MAX_IO_THREADS = 64;
+
+// bounds of the automatically tuned prefetch depth and the interval in which it is tuned.
+// the depth doubles while the hashing threads wait for reads more than 10% of the time
+// and shrinks while they wait less than 2% of the time
+const unsigned MAX_PREFETCH_DEPTH = 1024;
+const chrono::milliseconds PREFETCH_TUNE_INTERVAL(100);
+const double PREFETCH_GROW_WAIT = 0.10;
+const double PREFETCH_SHRINK_WAIT = 0.02;
+
+// largest thread pool of an autotuned scan (threads waiting for reads need no cpu)
+const unsigned AUTOTUNE_MAX_THREADS = 32;
+
+// interval in which the throughput of an autotuned scan is measured,
+// and the gain of throughput for which a change of a knob is kept
+const chrono::milliseconds AUTOTUNE_INTERVAL(500);
+const double AUTOTUNE_GAIN = 0.05;
+
+// interval in which the pressure is measured in background mode
+const chrono::milliseconds PRESSURE_INTERVAL(500);
+
+// codes of the command line options that only have a long form
+enum LongOption
+{
+    OPT_INODE_ORDER = 256,
+    OPT_HASH_CACHE,
+    OPT_HASH_CACHE_SIZE,
+    OPT_JOBS,
+    OPT_BACKGROUND,
+    OPT_MAX_PRESSURE,
+    OPT_MAX_READ_RATE,
+    OPT_MAX_CPU,
+    OPT_IDLE_IO,
+    OPT_PAGE_CACHE,
+    OPT_CACHE_FIRST,
+    OPT_PREFETCH,
+    OPT_DEVICE_READERS,
+    OPT_AUTOTUNE,
+    OPT_LARGEST_FIRST,
+    OPT_REORDER_BUFFER,
+    OPT_ASYNC,
+    OPT_CHANGED_HASH,
+    OPT_MEMORY_BUDGET,
+    OPT_MAX_MEMORY,
+};
 
 // print the help message
 void help()
 {
     cout << "Usage: siv <-i|-v|-h> -D <monitored_directory> -V <verification_file> " << endl;
-    cout << "       -R <report_file> -H <hash-function>" << endl;
+    cout << "       -R <report_file> -H <hash-function> [scan options]" << endl;
     cout << endl;
     cout << "Options:" << endl;
     cout << "  -i                       : starts siv in initialization mode" << endl;
@@ -64,6 +570,45 @@ void help()
     cout << "  -V <verification_file>   : the path to the verification file" << endl;
     cout << "  -R <report_file_>        : the path to the report file" << endl;
     cout << "  -H <hash-function>       : the hash function to be used" << endl;
+    cout << "  --inode-order            : stat entries in inode order and read files in physical extent order" << endl;
+    cout << "                             (speeds up scans of rotational disks and cold caches)" << endl;
+    cout << "  --hash-cache <cache_file>: reuse the message digests of unchanged files stored in the cache file," << endl;
+    cout << "                             which can be shared by several verification files" << endl;
+    cout << "  --hash-cache-size <size> : the maximum size of a new cache file, e.g. 64M (default) or 1G (up to a quarter" << endl;
+    cout << "                             of the memory limit). an existing cache file keeps its size, delete it to resize" << endl;
+    cout << "  --jobs <number>          : the number of hashing threads (default: the cpu limit of the cgroup)" << endl;
+    cout << "  --background             : run fewer hashing threads while the host is under io, cpu or memory pressure" << endl;
+    cout << "  --max-pressure <percent> : the stalled time above which a background scan yields (default: 10)" << endl;
+    cout << "  --max-read-rate <rate>   : the maximum number of bytes read per second, e.g. 200M" << endl;
+    cout << "  --max-cpu <cpus>         : the maximum number of cpus used for hashing, e.g. 1.5" << endl;
+    cout << "  --idle-io                : only read when no other process needs the disk (idle io priority class)" << endl;
+    cout << "  --page-cache <mode>      : keep (default) leaves the files read in the page cache, drop removes them" << endl;
+    cout << "                             after hashing and direct reads them with O_DIRECT. drop and direct leave" << endl;
+    cout << "                             the pages that were cached before the scan alone" << endl;
+    cout << "  --cache-first            : hash the files in the page cache first while the others are prefetched" << endl;
+    cout << "  --prefetch <files|auto>  : prefetch the next files of the queue while the current ones are hashed," << endl;
+    cout << "                             auto tunes the number of files from the time spent waiting for reads" << endl;
+    cout << "  --device-readers <number>: the number of files read from one device at the same time" << endl;
+    cout << "                             (default: 2 for disks that report to be rotational in sysfs, 8 otherwise)." << endl;
+    cout << "                             many virtual and cloud disks report to be rotational, give it for them" << endl;
+    cout << "  --autotune               : tune the number of hashing threads and device readers that are not set" << endl;
+    cout << "                             with --jobs and --device-readers from the throughput of the first seconds" << endl;
+    cout << "  --largest-first          : hash the large files in decreasing size order, interleaved with the small ones," << endl;
+    cout << "                             so that no thread is left with a large file at the end of a parallel scan" << endl;
+    cout << "  --reorder-buffer <size>  : the size of the lines hashed ahead of the path order that may wait to be written," << endl;
+    cout << "                             e.g. 16M (default: a 64th of the memory limit, up to 64M)" << endl;
+    cout << "  --async <files>          : keep this many files in flight with coroutines, whose reads are made by" << endl;
+    cout << "                             io threads while the hashing threads (--jobs) hash the chunks read" << endl;
+    cout << "                             (at most --device-readers of them from one device)" << endl;
+    cout << "  --changed-hash <policy>  : when files whose size, access rights, owner or last modified time changed are" << endl;
+    cout << "                             hashed in verification mode: defer (default) hashes them last, skip does not" << endl;
+    cout << "                             hash them and compute hashes them in the order of the scan" << endl;
+    cout << "  --memory-budget <size>   : verify trees larger than the memory, e.g. 1G: the scanned entries are hashed" << endl;
+    cout << "                             in batches, written to sorted run files in the temporary directory (TMPDIR)" << endl;
+    cout << "                             and merged with the verification file, which must be sorted by path" << endl;
+    cout << "  --max-memory <size>      : the memory siv may use, e.g. 2G (default: the memory limit of the cgroup). the" << endl;
+    cout << "                             buffers are sized from it, prefetching and reordering are held back near it" << endl;
+    cout << "                             and a verification that would not fit is made with a memory budget" << endl;
     cout << endl;
     cout << "Examples: " << endl;
     cout << "siv -i -D /home/user/monitored -V /home/user/verification -R /home/user/report.txt -H md5" << endl;
@@ -78,43 +623,368 @@ void help()
     cout << "- the verification file has to be an absolute path" << endl;
     cout << "- the report file has to be an absolute path" << endl;
     cout << "- line 4 of the verification file shows the headers for the tsv format below." << endl;
+    cout << "- verification files of earlier releases, whose first line has no format number, wrote whole-second" << endl;
+    cout << "  modification times one second early. they are verified as written, initialize again to upgrade them." << endl;
+    cout << "- the directories are recorded in <verification_file>.dirs, so that verification does not list the" << endl;
+    cout << "  directories that did not change again. it is only used with the verification file it was written with." << endl;
+    cout << "  it has to be protected and stored like the verification file." << endl;
+    cout << "- the hash cache file has to be protected like the verification file." << endl;
+}
+
+// set up a token bucket
+// bucket: the token bucket
+// rate: the number of tokens added per second (0 for no limit)
+void startBucket(TokenBucket &bucket, double rate)
+{
+    bucket.rate = rate;
+    bucket.burst = rate * BUCKET_BURST_SECONDS;
+    bucket.tokens = bucket.burst;
+    bucket.last = chrono::steady_clock::now();
+}
+
+// take tokens from a token bucket and wait while it is in debt
+// bucket: the token bucket
+// amount: the number of tokens taken
+void takeTokens(TokenBucket &bucket, double amount)
+{
+    if (bucket.rate == 0)
+    {
+        return;
+    }
+
+    double wait;
+    {
+        lock_guard<mutex> guard(bucket.lock);
+        auto now = chrono::steady_clock::now();
+        bucket.tokens = min(bucket.burst, bucket.tokens + bucket.rate * chrono::duration<double>(now - bucket.last).count());
+        bucket.last = now;
+        bucket.tokens -= amount;
+        wait = bucket.tokens < 0 ? -bucket.tokens / bucket.rate : 0;
+        bucket.waitedSeconds += wait;
+    }
+    if (wait > 0)
+    {
+        this_thread::sleep_for(chrono::duration<double>(wait));
+    }
+}
+
+// cpu time of the calling thread that was already charged to the cpu token bucket
+thread_local double chargedCpu = 0;
+
+// get the cpu time used by the calling thread (in seconds)
+double threadCpu()
+{
+    timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// start charging the cpu time of the calling thread from now on, so that a hashing thread
+// does not pay for what it did before the hashing started (e.g. the walk on the calling thread)
+void startCpuCharge()
+{
+    chargedCpu = threadCpu();
+}
+
+// take the cpu time the calling thread used since its last call from the cpu token bucket
+void chargeCpu()
+{
+    double cpu = threadCpu();
+    takeTokens(cpuBucket, cpu - chargedCpu);
+    chargedCpu = cpu;
+}
+
+// account for memory allocated or freed by a component
+// component: the component
+// bytes: the number of bytes allocated (negative if freed)
+void account(MemoryComponent component, int64_t bytes)
+{
+    int64_t used = memory.used[component].fetch_add(bytes, memory_order_relaxed) + bytes;
+    int64_t peak = memory.peak[component].load(memory_order_relaxed);
+    while (used > peak && !memory.peak[component].compare_exchange_weak(peak, used, memory_order_relaxed))
+    {
+    }
+}
+
+// read the resident memory of the process
+// returns the number of bytes, 0 if it can not be read
+uint64_t processRssBytes()
+{
+    ifstream statm("/proc/self/statm");
+    uint64_t pages = 0;
+    uint64_t resident = 0;
+    statm >> pages >> resident;
+    return resident * sysconf(_SC_PAGESIZE);
+}
+
+// find out whether the resident memory is near the memory limit, sampling it at most every MEMORY_SAMPLE_NS
+// returns true if memory is tight
+bool memoryTight()
+{
+    int64_t now = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+    int64_t sampled = memory.sampledNs.load(memory_order_relaxed);
+    if (now - sampled >= MEMORY_SAMPLE_NS && memory.sampledNs.compare_exchange_strong(sampled, now, memory_order_relaxed))
+    {
+        bool tight = processRssBytes() > resources.memoryLimit / 100 * MEMORY_TIGHT_PERCENT;
+        memory.tight.store(tight, memory_order_relaxed);
+        memory.tightSamples += tight;
+    }
+    return memory.tight.load(memory_order_relaxed);
+}
+
+// free a read buffer
+// buffer: the read buffer
+void freeReadBuffer(char *buffer)
+{
+    free(buffer);
+    account(MEM_READ_BUFFERS, -(int64_t)resources.readBufferSize);
+}
+
+// allocate a read buffer, aligned for reading with O_DIRECT
+unique_ptr<char, decltype(&freeReadBuffer)> allocateReadBuffer()
+{
+    void *buffer;
+    if (posix_memalign(&buffer, sysconf(_SC_PAGESIZE), resources.readBufferSize) != 0)
+    {
+        throw bad_alloc();
+    }
+    account(MEM_READ_BUFFERS, resources.readBufferSize);
+    return unique_ptr<char, decltype(&freeReadBuffer)>((char *)buffer, &freeReadBuffer);
+}
+
+// the read buffer of the calling thread
+char *readBuffer()
+{
+    thread_local unique_ptr<char, decltype(&freeReadBuffer)> buffer = allocateReadBuffer();
+    return buffer.get();
+}
+
+// find out which pages of a file are in the page cache, using mincore on a mapping of the file
+// fd: the open file
+// returns one byte per page with the lowest bit set for resident pages (empty for empty or unmappable files)
+vector<unsigned char> residentPages(int fd)
+{
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0)
+    {
+        return {};
+    }
+    void *map = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED)
+    {
+        return {};
+    }
+    long pageSize = sysconf(_SC_PAGESIZE);
+    vector<unsigned char> resident((st.st_size + pageSize - 1) / pageSize);
+    if (mincore(map, st.st_size, resident.data()) != 0)
+    {
+        resident.clear();
+    }
+    munmap(map, st.st_size);
+    return resident;
+}
+
+// drop the pages of a range of a file from the page cache that were not resident before the file was read
+// fd: the open file
+// resident: the residency of the pages before the file was read
+// offset: the start of the range (page aligned)
+// length: the length of the range
+void dropPages(int fd, const vector<unsigned char> &resident, off_t offset, size_t length)
+{
+    long pageSize = sysconf(_SC_PAGESIZE);
+    size_t first = offset / pageSize;
+    size_t last = min(resident.size(), (offset + length + pageSize - 1) / pageSize);
+
+    // drop the runs of pages that were not resident
+    for (size_t page = first; page < last;)
+    {
+        if (resident[page] & 1)
+        {
+            page++;
+            continue;
+        }
+        size_t end = page;
+        while (end < last && !(resident[end] & 1))
+        {
+            end++;
+        }
+        posix_fadvise(fd, page * pageSize, (end - page) * pageSize, POSIX_FADV_DONTNEED);
+        scanStats.droppedBytes += (end - page) * pageSize;
+        page = end;
+    }
+}
+
+// the state of a file whose message digest is computed
+struct FileDigest
+{
+    unique_ptr<crp::HashTransformation> hash; // the hash function
+    int fd = -1;                              // the open file (-1 if it can not be read)
+    bool direct = false;                      // true if the file is read with O_DIRECT
+    vector<unsigned char> resident;           // the pages cached before reading, if the others are dropped after hashing
+    off_t offset = 0;                         // number of bytes hashed
+    int error = 0;                            // errno of an open or read that failed (0 if the file was read to its end)
+};
+
+// select the hash function
+// hashF: the name of the hash function
+unique_ptr<crp::HashTransformation> newHash(const string &hashF)
+{
+    if (hashF == "md5")
+    {
+        return make_unique<crp::Weak::MD5>();
+    }
+    else if (hashF == "sha1")
+    {
+        return make_unique<crp::SHA1>();
+    }
+    cout << "Invalid hash function" << endl;
+    exit(EXIT_FAILURE);
 }
 
-// compute the message digest of a file
+// select the hash function and open a file to compute its message digest
+// digest: the state of the file
 // path: the path of the file
 // hashF: the hash function to be used
-string hashFile(string path, string hashF)
+void openDigest(FileDigest &digest, const string &path, const string &hashF)
 {
-    // open the file
-    ifstream file(path, ios::binary);
+    digest.hash = newHash(hashF);
+
+    // open the file, bypassing the page cache in direct mode if the file system supports it
+    if (scanOptions.pageCache == "direct")
+    {
+        digest.fd = open(path.c_str(), O_RDONLY | O_DIRECT);
+    }
+    digest.direct = digest.fd >= 0;
+    if (!digest.direct)
+    {
+        digest.fd = open(path.c_str(), O_RDONLY);
+    }
+    if (digest.fd < 0)
+    {
+        digest.error = errno;
+        return;
+    }
 
-    // read the file
-    string content((istreambuf_iterator<char>(file)), (istreambuf_iterator<char>()));
+    // the pages that were not cached before are dropped after hashing, unless the page cache is kept
+    if (!digest.direct && scanOptions.pageCache != "keep")
+    {
+        digest.resident = residentPages(digest.fd);
+    }
+    else if (digest.direct)
+    {
+        scanStats.directFiles++;
+    }
+}
 
-    // compute the message digest
-    string digest;
-    if (hashF == "md5")
+// hash the next chunk of a file
+// digest: the state of the file
+// buffer: the chunk read from the file
+// n: the size of the chunk
+void updateDigest(FileDigest &digest, const char *buffer, size_t n)
+{
+    digest.hash->Update((const crp::byte *)buffer, n);
+    scanStats.hashedBytes += n;
+    if (!digest.resident.empty())
     {
+        dropPages(digest.fd, digest.resident, digest.offset, n);
+    }
+    digest.offset += n;
+
+    // pay for the bytes read and the cpu time used (this waits if a limit is exceeded)
+    takeTokens(readBucket, n);
+    chargeCpu();
+}
 
-        crp::Weak::MD5 md5;
-        md5.Update((const crp::byte *)content.c_str(), content.length());
-        digest.resize(md5.DigestSize());
-        md5.Final((crp::byte *)&digest[0]);
+// read the next chunk of a file.
+// a file system may accept O_DIRECT when the file is opened and reject the reads, the file is then read
+// through the page cache from where the direct reads stopped (its pages are dropped after hashing).
+// a read that fails otherwise is recorded in digest.error
+// digest: the state of the file
+// path: the path of the file
+// buffer: the read buffer (resources.readBufferSize bytes)
+// returns the number of bytes read, 0 at the end of the file and -1 if the read failed
+ssize_t readChunk(FileDigest &digest, const string &path, char *buffer)
+{
+    ssize_t n = read(digest.fd, buffer, resources.readBufferSize);
+    if (n < 0 && digest.direct)
+    {
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd >= 0 && lseek(fd, digest.offset, SEEK_SET) == digest.offset)
+        {
+            close(digest.fd);
+            digest.fd = fd;
+            digest.direct = false;
+            scanStats.directFiles--;
+            digest.resident = residentPages(fd);
+            n = read(digest.fd, buffer, resources.readBufferSize);
+        }
+        else if (fd >= 0)
+        {
+            close(fd);
+        }
     }
-    else if (hashF == "sha1")
+    if (n < 0)
     {
-        crp::SHA1 sha1;
-        sha1.Update((const crp::byte *)content.c_str(), content.length());
-        digest.resize(sha1.DigestSize());
-        sha1.Final((crp::byte *)&digest[0]);
+        digest.error = errno;
     }
-    else
+    return n;
+}
+
+// close a file and compute its message digest
+// digest: the state of the file
+// returns an empty string if the file could not be opened or read
+string finishDigest(FileDigest &digest)
+{
+    if (digest.fd >= 0)
     {
-        cout << "Invalid hash function" << endl;
-        exit(EXIT_FAILURE);
+        close(digest.fd);
+    }
+    if (digest.error != 0)
+    {
+        return "";
+    }
+    string result;
+    result.resize(digest.hash->DigestSize());
+    digest.hash->Final((crp::byte *)&result[0]);
+    return result;
+}
+
+// compute the binary message digest of a file
+// path: the path of the file
+// hashF: the hash function to be used
+// error: set to the errno of an open or read that failed, 0 otherwise (may be nullptr)
+// returns an empty string if the file could not be opened or read
+string digestFile(string path, string hashF, int *error = nullptr)
+{
+    FileDigest digest;
+    openDigest(digest, path, hashF);
+
+    // read the file in chunks of the read buffer size
+    if (digest.fd >= 0)
+    {
+        char *buffer = readBuffer();
+        ssize_t n;
+        auto started = chrono::steady_clock::now();
+        auto readStart = started;
+        while ((n = readChunk(digest, path, buffer)) > 0)
+        {
+            prefetcher.readWaitNs += chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - readStart).count();
+            updateDigest(digest, buffer, n);
+            readStart = chrono::steady_clock::now();
+        }
+        prefetcher.hashingNs += chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - started).count();
+    }
+    if (error != nullptr)
+    {
+        *error = digest.error;
     }
+    return finishDigest(digest);
+}
 
-    // encode the message digest in hexadecimal using HexEncoder
+// encode a message digest in hexadecimal using HexEncoder
+// digest: the binary message digest
+string encodeHex(const string &digest)
+{
     string hash;
     crp::StringSink *ss = new crp::StringSink(hash);
     crp::HexEncoder *he = new crp::HexEncoder(ss);
@@ -123,146 +993,3217 @@ string hashFile(string path, string hashF)
     return hash;
 }
 
-// create a tsv string for a file or directory
+// convert a timespec to nanoseconds
+int64_t toNanoseconds(const timespec &ts)
+{
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// the last modification time of a scanned entry in nanoseconds
 // entry: the file or directory
-// hashF: the hash function to be used
-string createTsvString(const fs::directory_entry &entry, string hashF)
+int64_t mtimeNanoseconds(const ScanEntry &entry)
 {
-    // get the stat info of the file or directory
+    return entry.mtime * 1000000000 + entry.mtimeNsec;
+}
 
-    stat(entry.path().c_str(), &info);
+// parse a size with an optional K, M, G or T suffix (powers of 1024)
+// text: the size as given on the command line
+// returns 0 if the size is invalid
+uint64_t parseSize(const string &text)
+{
+    size_t end;
+    double value;
+    try
+    {
+        value = stod(text, &end);
+    }
+    catch (const exception &)
+    {
+        return 0;
+    }
+    string suffix = text.substr(end);
+    const string units = "KMGT";
+    if (suffix.size() > 1 || value < 0)
+    {
+        return 0;
+    }
+    if (suffix.size() == 1)
+    {
+        size_t unit = units.find(toupper(suffix[0]));
+        if (unit == string::npos)
+        {
+            return 0;
+        }
+        value *= pow(1024.0, unit + 1);
+    }
+    return (uint64_t)value;
+}
 
-    // get the full path to file or directory
-    string line = entry.path().string() + "\t";
+// read the first line of a file
+// path: the path of the file
+// returns an empty string if the file can not be read
+string readFirstLine(const string &path)
+{
+    ifstream file(path);
+    string line;
+    getline(file, line);
+    return line;
+}
 
-    // get the file size
-    line += to_string(info.st_size) + "\t";
+// find the cgroup directories of siv, from its own cgroup up to the root of the hierarchy
+// controller: the cgroup v1 controller, or an empty string for the cgroup v2 hierarchy
+vector<fs::path> cgroupDirectories(const string &controller)
+{
+    ifstream cgroups("/proc/self/cgroup");
+    string line;
+    while (getline(cgroups, line))
+    {
+        // the lines have the format hierarchy-id:controllers:path
+        size_t first = line.find(':');
+        size_t second = line.find(':', first + 1);
+        if (first == string::npos || second == string::npos)
+        {
+            continue;
+        }
+        string controllers = line.substr(first + 1, second - first - 1);
+        if (controller.empty() != controllers.empty() ||
+            (!controller.empty() && ("," + controllers + ",").find("," + controller + ",") == string::npos))
+        {
+            continue;
+        }
 
-    // get the name of the user owning the file or directory
+        // the v2 hierarchy is mounted below "unified" on hosts that use both versions
+        fs::path mount = "/sys/fs/cgroup";
+        if (!controller.empty())
+        {
+            mount /= controllers;
+        }
+        else if (!fs::exists(mount / "cgroup.controllers") && fs::exists(mount / "unified"))
+        {
+            mount /= "unified";
+        }
+
+        // inside a cgroup namespace the path of the cgroup does not exist below the mount point,
+        // the mount point is the cgroup of siv then
+        vector<fs::path> dirs;
+        fs::path dir = mount / fs::path(line.substr(second + 1)).relative_path();
+        while (true)
+        {
+            error_code ec;
+            if (fs::is_directory(dir, ec))
+            {
+                dirs.push_back(dir);
+            }
+            if (dir == mount || !dir.has_relative_path())
+            {
+                break;
+            }
+            dir = dir.parent_path();
+        }
+        return dirs;
+    }
+    return {};
+}
+
+// determine the cpu and memory limits of siv (cpu affinity, physical memory and the cgroup v2 or v1 limits)
+// and size the thread pool, the read buffers and the hash cache to fit them
+void detectResources()
+{
+    // cpus that siv may run on
+    cpu_set_t cpus;
+    resources.cpuLimit = sched_getaffinity(0, sizeof(cpus), &cpus) == 0 ? CPU_COUNT(&cpus) : thread::hardware_concurrency();
+    resources.cpuSource = "cpu affinity";
+
+    // cpu quota of the cgroup v2 hierarchy (cpu.max holds "quota period" or "max period")
+    for (const fs::path &dir : cgroupDirectories(""))
+    {
+        istringstream cpuMax(readFirstLine(dir / "cpu.max"));
+        string quota;
+        double period;
+        if (cpuMax >> quota >> period && quota != "max" && stod(quota) / period < resources.cpuLimit)
+        {
+            resources.cpuLimit = stod(quota) / period;
+            resources.cpuSource = "cgroup v2 cpu.max";
+        }
+    }
+
+    // cpu quota of the cgroup v1 hierarchy (a quota of -1 means unlimited)
+    for (const fs::path &dir : cgroupDirectories("cpu"))
+    {
+        string quota = readFirstLine(dir / "cpu.cfs_quota_us");
+        string period = readFirstLine(dir / "cpu.cfs_period_us");
+        if (!quota.empty() && !period.empty() && stod(quota) > 0 && stod(quota) / stod(period) < resources.cpuLimit)
+        {
+            resources.cpuLimit = stod(quota) / stod(period);
+            resources.cpuSource = "cgroup v1 cpu.cfs_quota_us";
+        }
+    }
+
+    // physical memory
+    resources.memoryLimit = (uint64_t)sysconf(_SC_PHYS_PAGES) * sysconf(_SC_PAGESIZE);
+    resources.memorySource = "physical memory";
+
+    // memory limit of the cgroup v2 hierarchy (memory.max holds a number of bytes or "max")
+    for (const fs::path &dir : cgroupDirectories(""))
+    {
+        string limit = readFirstLine(dir / "memory.max");
+        if (!limit.empty() && limit != "max" && stoull(limit) < resources.memoryLimit)
+        {
+            resources.memoryLimit = stoull(limit);
+            resources.memorySource = "cgroup v2 memory.max";
+        }
+    }
+
+    // memory limit of the cgroup v1 hierarchy
+    for (const fs::path &dir : cgroupDirectories("memory"))
+    {
+        string limit = readFirstLine(dir / "memory.limit_in_bytes");
+        if (!limit.empty() && stoull(limit) < resources.memoryLimit)
+        {
+            resources.memoryLimit = stoull(limit);
+            resources.memorySource = "cgroup v1 memory.limit_in_bytes";
+        }
+    }
+
+    // the limit given by the user
+    if (scanOptions.maxMemory > 0 && scanOptions.maxMemory < resources.memoryLimit)
+    {
+        resources.memoryLimit = scanOptions.maxMemory;
+        resources.memorySource = "--max-memory";
+    }
+
+    // a thread per cpu that may be used in full, so that the quota does not throttle the scan
+    resources.workers = scanOptions.jobs > 0 ? scanOptions.jobs : max(1u, (unsigned)floor(resources.cpuLimit));
+    resources.running = resources.workers;
+
+    // an autotuned scan may run more threads than cpus, to have more reads in flight
+    // (unless the pressure monitor decides on the number of running threads)
+    if (scanOptions.autotune && scanOptions.jobs == 0 && !scanOptions.background)
+    {
+        resources.workers = max(resources.workers, AUTOTUNE_MAX_THREADS);
+    }
+
+    // more threads than the cpu budget could keep busy would only wait for the budget
+    if (scanOptions.maxCpu > 0)
+    {
+        resources.workers = min(resources.workers, (unsigned)ceil(scanOptions.maxCpu));
+        resources.running = min(resources.running, resources.workers);
+    }
+
+    // the read buffers of all threads share a small part of the memory limit
+    // (in an async scan every slot has a read buffer)
+    uint64_t bufferSize = resources.memoryLimit / READ_BUFFER_SHARE / (scanOptions.async > 0 ? scanOptions.async : resources.workers);
+    uint64_t pageSize = sysconf(_SC_PAGESIZE);
+    resources.readBufferSize = clamp<uint64_t>(bufferSize / pageSize * pageSize, MIN_READ_BUFFER, MAX_READ_BUFFER);
+
+    // the lines waiting in the reorder buffer
+    resources.reorderBytes = scanOptions.reorderBuffer > 0 ? scanOptions.reorderBuffer
+                                                           : min(MAX_REORDER_BUFFER, resources.memoryLimit / REORDER_BUFFER_SHARE);
+
+    // prefetched pages are charged to the cgroup until they are hashed
+    resources.prefetchBytes = min(MAX_PREFETCH_BYTES, resources.memoryLimit / PREFETCH_SHARE);
+
+    // the pages of the mapped hash cache are charged to the cgroup as well
+    // (an existing cache file keeps its size, this only limits the size of a new one)
+    scanOptions.hashCacheSize = min(scanOptions.hashCacheSize, resources.memoryLimit / HASH_CACHE_SHARE);
+}
+
+// read the total time (in microseconds) in which some tasks stalled on a resource
+// resource: io, cpu or memory
+// returns 0 if the kernel does not provide pressure stall information
+uint64_t readStallTime(const string &resource)
+{
+    // the first line has the format "some avg10=0.00 avg60=0.00 avg300=0.00 total=0"
+    string line = readFirstLine("/proc/pressure/" + resource);
+    size_t total = line.find("total=");
+    return total == string::npos ? 0 : stoull(line.substr(total + 6));
+}
+
+// measure the io, cpu and memory pressure of the host until the hashing is done.
+// the number of running hashing threads is halved while the pressure exceeds the maximum
+// and grows again by one thread while it stays below a quarter of the maximum
+void monitorPressure()
+{
+    const string pressures[] = {"io", "cpu", "memory"};
+    uint64_t lastStall[3];
+    for (int i = 0; i < 3; i++)
+    {
+        lastStall[i] = readStallTime(pressures[i]);
+    }
+    auto last = chrono::steady_clock::now();
+
+    unique_lock<mutex> guard(throttle.lock);
+    while (!throttle.changed.wait_for(guard, PRESSURE_INTERVAL, []
+                                      { return throttle.done; }))
+    {
+        // the highest share of stalled time of the three resources since the last measurement
+        auto now = chrono::steady_clock::now();
+        double elapsed = chrono::duration_cast<chrono::microseconds>(now - last).count();
+        double pressure = 0;
+        for (int i = 0; i < 3; i++)
+        {
+            uint64_t stall = readStallTime(pressures[i]);
+            pressure = max(pressure, 100.0 * (stall - lastStall[i]) / elapsed);
+            lastStall[i] = stall;
+        }
+        if (throttle.active < resources.workers)
+        {
+            throttle.throttledSeconds += elapsed / 1e6;
+        }
+        last = now;
+
+        if (pressure > scanOptions.maxPressure && throttle.active > 1)
+        {
+            throttle.active = throttle.active / 2;
+            throttle.minActive = min(throttle.minActive, throttle.active.load());
+        }
+        else if (pressure < scanOptions.maxPressure / 4 && throttle.active < resources.workers)
+        {
+            throttle.active++;
+            throttle.changed.notify_all();
+        }
+    }
+}
+
+// block a hashing thread while the throttle does not let it run (and there are files left)
+// worker: the number of the hashing thread
+void waitForTurn(unsigned worker)
+{
+    if (worker < throttle.active)
+    {
+        return;
+    }
+    unique_lock<mutex> guard(throttle.lock);
+    throttle.changed.wait(guard, [&]
+                          { return worker < throttle.active || throttle.drained; });
+}
+
+// set the number of running hashing threads
+// running: the number of threads
+void setRunningThreads(unsigned running)
+{
+    {
+        lock_guard<mutex> guard(throttle.lock);
+        throttle.active = running;
+    }
+    throttle.changed.notify_all();
+}
+
+// measure the number of bytes hashed per second during one tuning interval
+// returns a negative value when the hashing is finished
+double measureThroughput()
+{
+    uint64_t before = scanStats.hashedBytes;
+    auto start = chrono::steady_clock::now();
+    unique_lock<mutex> guard(throttle.lock);
+    if (throttle.changed.wait_for(guard, AUTOTUNE_INTERVAL, []
+                                  { return throttle.done; }))
+    {
+        return -1;
+    }
+    return (scanStats.hashedBytes - before) / chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+// hill climb a knob of the scan: its value is doubled as long as that increases the throughput by more than
+// AUTOTUNE_GAIN. if doubling does not help, the value is halved as long as that increases the throughput
+// value: the current value of the knob
+// maxValue: the largest value of the knob
+// apply: sets the knob to a value
+// returns false if the hashing finished before the knob was tuned
+bool hillClimb(unsigned value, unsigned maxValue, const function<void(unsigned)> &apply)
+{
+    double best = measureThroughput();
+    for (bool up : {true, false})
+    {
+        bool improved = false;
+        while (best >= 0)
+        {
+            unsigned candidate = up ? min(maxValue, 2 * value) : max(1u, value / 2);
+            if (candidate == value)
+            {
+                break;
+            }
+            apply(candidate);
+            double throughput = measureThroughput();
+            if (throughput < 0)
+            {
+                apply(value);
+                return false;
+            }
+            if (throughput <= best * (1 + AUTOTUNE_GAIN))
+            {
+                apply(value);
+                break;
+            }
+            best = throughput;
+            value = candidate;
+            improved = true;
+        }
+        if (improved)
+        {
+            break;
+        }
+    }
+    return best >= 0;
+}
+
+// tune the number of running hashing threads and then the number of readers of each device
+// that were not set on the command line, one after the other, at the start of the scan.
+// a scan spilled in batches goes on with the knobs that were not tuned yet in the next batch
+void autotuneScan()
+{
+    // in background mode the pressure monitor decides on the number of running threads
+    if (scanOptions.jobs == 0 && !scanOptions.background && !throttle.tuned)
+    {
+        throttle.tuned = hillClimb(throttle.active, resources.workers, setRunningThreads);
+    }
+
+    if (scanOptions.deviceReaders == 0)
+    {
+        for (auto &queue : scheduler.queues)
+        {
+            if (queue->tuned || queue->files.empty())
+            {
+                continue;
+            }
+            queue->tuned = hillClimb(queue->maxReaders, resources.workers, [&](unsigned readers)
+                                     {
+                                         {
+                                             lock_guard<mutex> guard(scheduler.lock);
+                                             queue->maxReaders = readers;
+                                         }
+                                         scheduler.freed.notify_all(); });
+        }
+    }
+}
+
+// mix the bits of a 64 bit value (splitmix64 finalizer)
+uint64_t mix64(uint64_t x)
+{
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebULL;
+    x ^= x >> 31;
+    return x;
+}
+
+// the identifier of a hash function in the hash cache
+uint8_t hashCacheId(const string &hashF)
+{
+    return hashF == "md5" ? 1 : 2;
+}
+
+// compute the checksum of a hash cache slot
+uint64_t hashCacheCheck(const HashCacheSlot &slot)
+{
+    const uint64_t *words = (const uint64_t *)&slot;
+    uint64_t check = 0x5349564843ULL;
+    for (size_t i = 0; i < offsetof(HashCacheSlot, check) / sizeof(uint64_t); i++)
+    {
+        check = mix64(check ^ words[i]);
+    }
+    return check;
+}
+
+// open (or create) the hash cache file and map it into memory.
+// an existing cache is used with the number of slots of its header, whatever size this run would give
+// a new cache, so that runs with different memory limits can share it. only a file that is not a valid
+// cache is cleared. the file is locked while the cache is used, so that runs sharing the cache do not
+// write to it at the same time. if another run holds the lock, the scan continues without cache
+// path: the path of the cache file
+// maxSize: the maximum size of a new cache file in bytes
+void openHashCache(const string &path, uint64_t maxSize)
+{
+    int fd = open(path.c_str(), O_RDWR | O_CREAT, 0600);
+    if (fd < 0)
+    {
+        cout << "The hash cache file can not be opened" << endl;
+        exit(EXIT_FAILURE);
+    }
+    if (flock(fd, LOCK_EX | LOCK_NB) != 0)
+    {
+        cout << "The hash cache file is in use by another run, continuing without cache" << endl;
+        hashCache.busy = true;
+        close(fd);
+        return;
+    }
+
+    // keep the size of a valid cache file, clear a file whose size does not match its header or of another format
+    struct stat st;
+    HashCacheHeader header = {};
+    bool valid = fstat(fd, &st) == 0 && pread(fd, &header, sizeof(header), 0) == sizeof(header) &&
+                 strncmp(header.magic, "SIVHC01", sizeof(header.magic)) == 0 && header.slotCount >= HASH_CACHE_PROBES &&
+                 header.slotCount <= ((uint64_t)st.st_size - sizeof(HashCacheHeader)) / sizeof(HashCacheSlot) &&
+                 (uint64_t)st.st_size == sizeof(HashCacheHeader) + header.slotCount * sizeof(HashCacheSlot);
+    uint64_t slotCount = valid ? header.slotCount : (maxSize - sizeof(HashCacheHeader)) / sizeof(HashCacheSlot);
+    uint64_t size = sizeof(HashCacheHeader) + slotCount * sizeof(HashCacheSlot);
+    if (!valid)
+    {
+        if (maxSize <= sizeof(HashCacheHeader) || slotCount < HASH_CACHE_PROBES)
+        {
+            cout << "The hash cache size is too small" << endl;
+            exit(EXIT_FAILURE);
+        }
+        header = {"SIVHC01", slotCount, 0};
+        if (ftruncate(fd, 0) != 0 || ftruncate(fd, size) != 0 || pwrite(fd, &header, sizeof(header), 0) != sizeof(header))
+        {
+            cout << "The hash cache file can not be created" << endl;
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    void *map = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED)
+    {
+        cout << "The hash cache file can not be mapped" << endl;
+        exit(EXIT_FAILURE);
+    }
+    hashCache.fd = fd;
+    hashCache.header = (HashCacheHeader *)map;
+    hashCache.slots = (HashCacheSlot *)((char *)map + sizeof(HashCacheHeader));
+    hashCache.mappedSize = size;
+    hashCache.run = ++hashCache.header->run;
+
+    // files that changed shortly before the scan could change again within the timestamp granularity
+    timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    hashCache.settledBefore = toNanoseconds(now) - SETTLE_TIME_NS;
+}
+
+// unmap and unlock the hash cache file
+void closeHashCache()
+{
+    if (hashCache.fd >= 0)
+    {
+        munmap(hashCache.header, hashCache.mappedSize);
+        close(hashCache.fd);
+        hashCache.fd = -1;
+    }
+}
+
+// find the slot of a file in the hash cache
+// entry: the file
+// hashF: the hash function to be used
+// returns nullptr if the file is not cached
+HashCacheSlot *findHashCacheSlot(const ScanEntry &entry, const string &hashF)
+{
+    uint64_t start = mix64(entry.dev ^ mix64(entry.ino));
+    for (uint64_t probe = 0; probe < HASH_CACHE_PROBES; probe++)
+    {
+        HashCacheSlot &slot = hashCache.slots[(start + probe) % hashCache.header->slotCount];
+        if (slot.hashId == hashCacheId(hashF) && slot.dev == entry.dev && slot.ino == entry.ino &&
+            slot.size == entry.size && slot.mtimeNs == mtimeNanoseconds(entry) &&
+            slot.ctimeNs == entry.ctimeNs && slot.check == hashCacheCheck(slot))
+        {
+            return &slot;
+        }
+    }
+    return nullptr;
+}
+
+// store the digest of a file in the hash cache, replacing an older digest of the same file,
+// an empty slot or the least recently used slot
+// entry: the file, whose digest is stored
+// hashF: the hash function used
+void storeHashCache(const ScanEntry &entry, const string &hashF)
+{
+    if (entry.ctimeNs >= hashCache.settledBefore || entry.digestSize > sizeof(HashCacheSlot::digest))
+    {
+        return;
+    }
+
+    uint64_t start = mix64(entry.dev ^ mix64(entry.ino));
+    HashCacheSlot *victim = nullptr;
+    for (uint64_t probe = 0; probe < HASH_CACHE_PROBES; probe++)
+    {
+        HashCacheSlot &slot = hashCache.slots[(start + probe) % hashCache.header->slotCount];
+        if (slot.hashId == hashCacheId(hashF) && slot.dev == entry.dev && slot.ino == entry.ino)
+        {
+            victim = &slot;
+            break;
+        }
+        if (victim == nullptr || (victim->hashId != 0 && (slot.hashId == 0 || slot.lastUsed < victim->lastUsed)))
+        {
+            victim = &slot;
+        }
+    }
+
+    HashCacheSlot slot = {};
+    slot.dev = entry.dev;
+    slot.ino = entry.ino;
+    slot.size = entry.size;
+    slot.mtimeNs = mtimeNanoseconds(entry);
+    slot.ctimeNs = entry.ctimeNs;
+    slot.lastUsed = hashCache.run;
+    slot.hashId = hashCacheId(hashF);
+    slot.digestSize = entry.digestSize;
+    memcpy(slot.digest, entry.digest, entry.digestSize);
+    slot.check = hashCacheCheck(slot);
+    *victim = slot;
+}
+
+// look up the message digest of a file in the hash cache, if one is open
+// entry: the file, whose digest is set if it is found
+// hashF: the hash function to be used
+// returns true if the digest was found
+bool lookupHashCache(ScanEntry &entry, const string &hashF)
+{
+    if (hashCache.fd < 0 || !S_ISREG(entry.mode))
+    {
+        return false;
+    }
+
+    HashCacheSlot *slot = findHashCacheSlot(entry, hashF);
+    if (slot == nullptr)
+    {
+        return false;
+    }
+    hashCache.hits++;
+    slot->lastUsed = hashCache.run;
+    slot->check = hashCacheCheck(*slot);
+    entry.digestSize = slot->digestSize;
+    memcpy(entry.digest, slot->digest, slot->digestSize);
+    return true;
+}
+
+// set the message digest of a file and store it in the hash cache, if one is open
+// entry: the file
+// hashF: the hash function used
+// digest: the binary message digest (empty if the file could not be read)
+// error: the errno of a read of the file that failed, 0 otherwise
+void recordDigest(ScanEntry &entry, const string &hashF, const string &digest, int error)
+{
+    entry.readError = error;
+    entry.digestSize = min(digest.size(), sizeof(entry.digest));
+    memcpy(entry.digest, digest.data(), entry.digestSize);
+    if (hashCache.fd < 0 || !S_ISREG(entry.mode) || digest.empty())
+    {
+        return;
+    }
+
+    lock_guard<mutex> guard(hashCache.lock);
+    hashCache.misses++;
+    storeHashCache(entry, hashF);
+}
+
+// compute the message digest of a file and store it in the hash cache, if one is open
+// entry: the file
+// hashF: the hash function to be used
+void hashEntry(ScanEntry &entry, string hashF)
+{
+    int error;
+    string digest = digestFile(entry.path, hashF, &error);
+    recordDigest(entry, hashF, digest, error);
+}
+
+// copy the fields of the stat info of an entry of the monitored directory that are kept
+// entry: the entry
+// st: the stat info of the entry
+void setStat(ScanEntry &entry, const struct stat &st)
+{
+    entry.size = st.st_size;
+    entry.mtime = st.st_mtim.tv_sec;
+    entry.mtimeNsec = st.st_mtim.tv_nsec;
+    entry.ctimeNs = toNanoseconds(st.st_ctim);
+    entry.dev = st.st_dev;
+    entry.ino = st.st_ino;
+    entry.uid = st.st_uid;
+    entry.mode = st.st_mode;
+    entry.nlink = st.st_nlink;
+    entry.isDirectory = S_ISDIR(st.st_mode);
+}
+
+// stat an entry of the monitored directory, following symbolic links.
+// broken symbolic links are described by the link itself
+// entry: the entry whose path is set
+// returns false if the entry no longer exists
+bool statEntry(ScanEntry &entry)
+{
+    struct stat st;
+    if (stat(entry.path.c_str(), &st) != 0 && lstat(entry.path.c_str(), &st) != 0)
+    {
+        return false;
+    }
+    setStat(entry, st);
+    return true;
+}
+
+// the path of a directory without trailing separator, as used by the directory records
+// dirPath: the path of the directory
+string directoryKey(const fs::path &dirPath)
+{
+    return dirPath.has_filename() ? dirPath.string() : dirPath.parent_path().string();
+}
+
+// an entry of a directory batch, before it is stat-ed
+struct DirEntry
+{
+    string name;        // name of the entry
+    ino_t ino;          // inode number of the entry
+    unsigned char type; // type of the entry (DT_*)
+};
+
+// read the next entries of a directory with readdir
+// dir: the directory
+// batch: the list the entries are appended to
+// limit: the largest number of entries read
+// returns false once all entries of the directory were read
+bool readEntries(DIR *dir, vector<DirEntry> &batch, size_t limit)
+{
+    struct dirent *de;
+    while (batch.size() < limit)
+    {
+        if ((de = readdir(dir)) == nullptr)
+        {
+            return false;
+        }
+        if (strcmp(de->d_name, ".") != 0 && strcmp(de->d_name, "..") != 0)
+        {
+            batch.push_back({de->d_name, de->d_ino, de->d_type});
+        }
+    }
+    return true;
+}
+
+// record a directory that was read in walk.records, if it has settled
+// dirPath: the path of the directory
+// dirSt: the stat info of the directory from before it was read
+// count: the number of entries of the directory
+// walk: the state of the walk
+void recordDirectory(const fs::path &dirPath, const struct stat &dirSt, size_t count, WalkState &walk)
+{
+    timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    // (the records are not kept when the entries are spilled, as they are only written by initialization)
+    if (!walk.spill && toNanoseconds(dirSt.st_ctim) + SETTLE_TIME_NS < toNanoseconds(now))
+    {
+        walk.records.push_back({directoryKey(dirPath), dirSt.st_ino, toNanoseconds(dirSt.st_mtim), toNanoseconds(dirSt.st_ctim), count});
+    }
+}
+
+// rebuild the entries of a directory from its record in the verification file, without reading the directory.
+// this is only possible if the directory has not changed since it was recorded:
+// entries can not be added, removed or renamed without changing the modification and status change time
+// dirPath: the path of the directory
+// walk: the state of the walk
+// scanned: the list the stat-ed entries are stored in
+// types: the list their types (DT_*) are stored in
+// returns false if the directory has to be read
+bool reuseListing(const fs::path &dirPath, WalkState &walk, vector<ScanEntry> &scanned, vector<unsigned char> &types)
+{
+    // the directories that are walked before the verification file is loaded are read
+    if (!walk.knownReady.load(memory_order_acquire))
+    {
+        return false;
+    }
+
+    string key = directoryKey(dirPath);
+    auto record = walk.known.find(key);
+    if (record == walk.known.end())
+    {
+        return false;
+    }
+
+    // compare the directory with its record
+    struct stat dirSt;
+    const vector<string> &children = walk.knownChildren[key];
+    if (stat(dirPath.c_str(), &dirSt) != 0 || dirSt.st_ino != record->second.ino ||
+        toNanoseconds(dirSt.st_mtim) != record->second.mtimeNs || toNanoseconds(dirSt.st_ctim) != record->second.ctimeNs ||
+        children.size() != record->second.childCount)
+    {
+        return false;
+    }
+
+    // the entries still have to be stat-ed to notice changes of their content
+    // (symbolic links are described by their target)
+    for (const string &name : children)
+    {
+        ScanEntry child;
+        child.path = (dirPath / name).string();
+        struct stat st;
+        if (lstat(child.path.c_str(), &st) != 0 || (S_ISLNK(st.st_mode) && !statEntry(child)))
+        {
+            scanned.clear();
+            types.clear();
+            return false;
+        }
+        if (!S_ISLNK(st.st_mode))
+        {
+            setStat(child, st);
+        }
+        scanned.push_back(move(child));
+        types.push_back(IFTODT(st.st_mode));
+    }
+    walk.reused++;
+    return true;
+}
+
+// stat the entries of a directory batch, in inode order if requested (inodes are laid out in that order on disk)
+// dirPath: the path of the directory
+// batch: the entries read from the directory
+// scanned: the list the entries are stored in, in directory order. entries removed since the directory
+// was read are left out, as if the directory had been read later
+// types: the list the types (DT_*) of the entries are stored in
+void statBatch(const fs::path &dirPath, const vector<DirEntry> &batch, vector<ScanEntry> &scanned, vector<unsigned char> &types)
+{
+    vector<size_t> order(batch.size());
+    iota(order.begin(), order.end(), 0);
+    if (scanOptions.inodeOrder)
+    {
+        sort(order.begin(), order.end(), [&](size_t a, size_t b)
+             { return batch[a].ino < batch[b].ino; });
+    }
+    vector<ScanEntry> stated(batch.size());
+    vector<bool> removed(batch.size(), false);
+    for (size_t i : order)
+    {
+        stated[i].path = (dirPath / batch[i].name).string();
+        removed[i] = !statEntry(stated[i]);
+    }
+    for (size_t i = 0; i < batch.size(); i++)
+    {
+        if (!removed[i])
+        {
+            scanned.push_back(move(stated[i]));
+            types.push_back(batch[i].type);
+        }
+    }
+}
+
+// hand the entries walked so far over once they take up their share of the memory budget
+// (or earlier, in smaller batches, when memory is tight)
+// entries: the entries walked since the last spill
+// walk: the state of the walk
+void spillWalked(vector<ScanEntry> &entries, WalkState &walk)
+{
+    if (walk.spill && (walk.walkedBytes >= walk.spillBytes || (walk.walkedBytes > 0 && memoryTight())))
+    {
+        walk.spill(entries);
+        account(MEM_SCANNED_ENTRIES, -(int64_t)walk.walkedBytes);
+        walk.walkedBytes = 0;
+    }
+}
+
+void walkDirectory(const fs::path &dirPath, vector<ScanEntry> &entries, WalkState &walk);
+
+// append the stat-ed entries of a directory and descend into its subdirectories (but not into links to them)
+// scanned: the entries in directory order
+// types: the types (DT_*) of the entries
+// entries: the list the entries are appended to
+// walk: the state of the walk
+void appendEntries(vector<ScanEntry> &scanned, const vector<unsigned char> &types, vector<ScanEntry> &entries, WalkState &walk)
+{
+    for (size_t i = 0; i < scanned.size(); i++)
+    {
+        bool descend = types[i] == DT_DIR;
+        if (types[i] == DT_UNKNOWN)
+        {
+            struct stat lst;
+            descend = lstat(scanned[i].path.c_str(), &lst) == 0 && S_ISDIR(lst.st_mode);
+        }
+        uint64_t entryBytes = sizeof(ScanEntry) + scanned[i].path.capacity() + SPILL_ENTRY_OVERHEAD;
+        walk.walkedBytes += entryBytes;
+        account(MEM_SCANNED_ENTRIES, entryBytes);
+        entries.push_back(move(scanned[i]));
+        if (descend)
+        {
+            walkDirectory(entries.back().path, entries, walk);
+        }
+    }
+}
+
+// walk the directory tree below dirPath and append its entries to entries.
+// the entries are visited in the same order as fs::recursive_directory_iterator visits them,
+// but each directory is read in batches so that its entries can be stat-ed in inode order.
+// a directory is read in one batch, unless the entries are spilled: then it is read in batches of
+// WALK_BATCH_ENTRIES, between which the entries walked so far can be spilled
+// dirPath: the path of the directory to be walked
+// entries: the list the entries are appended to
+// walk: the state of the walk
+void walkDirectory(const fs::path &dirPath, vector<ScanEntry> &entries, WalkState &walk)
+{
+    spillWalked(entries, walk);
+
+    vector<ScanEntry> scanned;
+    vector<unsigned char> types;
+    if (reuseListing(dirPath, walk, scanned, types))
+    {
+        appendEntries(scanned, types, entries, walk);
+        return;
+    }
+
+    DIR *dir = opendir(dirPath.c_str());
+    if (dir == nullptr)
+    {
+        throw fs::filesystem_error("cannot open directory", dirPath, error_code(errno, system_category()));
+    }
+
+    // remember the state of the directory before it is read
+    struct stat dirSt;
+    bool haveDirSt = fstat(dirfd(dir), &dirSt) == 0;
+
+    // (the directory stays open while the subdirectories of a batch are walked, unless it was read to its end)
+    size_t count = 0;
+    bool more = true;
+    vector<DirEntry> batch;
+    while (more)
+    {
+        batch.clear();
+        more = readEntries(dir, batch, walk.spill ? WALK_BATCH_ENTRIES : SIZE_MAX);
+        count += batch.size();
+        if (!more)
+        {
+            closedir(dir);
+            if (haveDirSt)
+            {
+                recordDirectory(dirPath, dirSt, count, walk);
+            }
+        }
+
+        scanned.clear();
+        types.clear();
+        statBatch(dirPath, batch, scanned, types);
+        appendEntries(scanned, types, entries, walk);
+        spillWalked(entries, walk);
+    }
+}
+
+// get the physical position of the first extent of a file using the FIEMAP ioctl.
+// falls back to the inode number on file systems that do not support FIEMAP
+// entry: the file
+uint64_t readPosition(const ScanEntry &entry)
+{
+    uint64_t position = entry.ino;
+    int fd = open(entry.path.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        return position;
+    }
+
+    // ask for the first extent only
+    char buffer[sizeof(struct fiemap) + sizeof(struct fiemap_extent)] = {};
+    struct fiemap *fm = (struct fiemap *)buffer;
+    fm->fm_start = 0;
+    fm->fm_length = FIEMAP_MAX_OFFSET;
+    fm->fm_extent_count = 1;
+    if (ioctl(fd, FS_IOC_FIEMAP, fm) == 0 && fm->fm_mapped_extents > 0)
+    {
+        position = fm->fm_extents[0].fe_physical;
+    }
+    close(fd);
+    return position;
+}
+
+// count the bytes of a file that are in the page cache
+// entry: the file
+uint64_t residentBytes(const ScanEntry &entry)
+{
+    int fd = open(entry.path.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        return 0;
+    }
+    vector<unsigned char> resident = residentPages(fd);
+    close(fd);
+
+    uint64_t pages = count_if(resident.begin(), resident.end(), [](unsigned char page)
+                              { return page & 1; });
+    return min<uint64_t>(pages * sysconf(_SC_PAGESIZE), entry.size);
+}
+
+// start reading the beginning of a file into the page cache without waiting for the reads to complete
+// entry: the file
+// length: the number of bytes to be read
+void prefetchFile(const ScanEntry &entry, uint64_t length)
+{
+    int fd = open(entry.path.c_str(), O_RDONLY);
+    if (fd >= 0)
+    {
+        posix_fadvise(fd, 0, length, POSIX_FADV_WILLNEED);
+        close(fd);
+    }
+}
+
+// tune the prefetch depth from the share of time the hashing threads waited for reads since the last call
+void tunePrefetchDepth()
+{
+    static uint64_t lastReadWait = 0, lastHashing = 0;
+    static auto last = chrono::steady_clock::now();
+    auto now = chrono::steady_clock::now();
+    if (now - last < PREFETCH_TUNE_INTERVAL)
+    {
+        return;
+    }
+    uint64_t readWait = prefetcher.readWaitNs, hashing = prefetcher.hashingNs;
+    if (hashing > lastHashing)
+    {
+        double wait = (double)(readWait - lastReadWait) / (hashing - lastHashing);
+        if (wait > PREFETCH_GROW_WAIT && prefetcher.depth < MAX_PREFETCH_DEPTH)
+        {
+            prefetcher.depth = min(2 * prefetcher.depth, MAX_PREFETCH_DEPTH);
+            prefetcher.maxDepth = max(prefetcher.maxDepth, prefetcher.depth.load());
+        }
+        else if (wait < PREFETCH_SHRINK_WAIT && prefetcher.depth > 1)
+        {
+            prefetcher.depth--;
+        }
+    }
+    lastReadWait = readWait;
+    lastHashing = hashing;
+    last = now;
+}
+
+// prefetch the files of the device queues that are not in the page cache, ahead of the hashing threads.
+// in each queue the prefetch thread stays at most prefetcher.depth uncached files and its share of
+// resources.prefetchBytes of uncached data ahead of the next file to be hashed
+// entries: the entries of the monitored directory
+void prefetchQueues(const vector<ScanEntry> &entries)
+{
+    uint64_t maxBytes = resources.prefetchBytes / max<size_t>(1, scheduler.queues.size());
+    while (true)
+    {
+        bool pending = false;
+        bool issued = false;
+        for (auto &queue : scheduler.queues)
+        {
+            // skip the files that are cached or already taken by a hashing thread
+            size_t head = min(queue->next.load(), queue->files.size());
+            queue->prefetched = max(queue->prefetched, head);
+            while (queue->prefetched < queue->files.size() && queue->coldBytes[queue->prefetched + 1] == queue->coldBytes[queue->prefetched])
+            {
+                queue->prefetched++;
+            }
+            if (queue->prefetched == queue->files.size())
+            {
+                continue;
+            }
+            pending = true;
+
+            size_t p = queue->prefetched;
+            if (queue->coldFiles[p] < queue->coldFiles[head] + prefetcher.depth && queue->coldBytes[p] <= queue->coldBytes[head] + maxBytes &&
+                (p == head || !memoryTight()))
+            {
+                prefetchFile(entries[queue->files[p]], min(queue->coldBytes[p + 1] - queue->coldBytes[p], maxBytes));
+                queue->prefetched++;
+                issued = true;
+            }
+        }
+        if (!pending)
+        {
+            return;
+        }
+
+        // wait until the hashing threads caught up
+        if (!issued)
+        {
+            unique_lock<mutex> guard(prefetcher.lock);
+            if (scanOptions.prefetch < 0)
+            {
+                tunePrefetchDepth();
+            }
+            if (prefetcher.done || prefetcher.progress.wait_for(guard, chrono::milliseconds(10), []
+                                                                { return prefetcher.done; }))
+            {
+                return;
+            }
+        }
+    }
+}
+
+// find out whether a device is a rotational disk, from /sys/dev/block/<major>:<minor>/queue/rotational
+// (the queue of a partition is in the directory of its disk)
+// dev: the device
+// returns 1 for rotational disks, 0 for other block devices and -1 for other file systems (e.g. tmpfs)
+int rotationalDevice(dev_t dev)
+{
+    fs::path dir = "/sys/dev/block/" + to_string(major(dev)) + ":" + to_string(minor(dev));
+    for (const fs::path &queue : {dir / "queue", dir / ".." / "queue"})
+    {
+        string rotational = readFirstLine(queue / "rotational");
+        if (!rotational.empty())
+        {
+            return rotational == "1" ? 1 : 0;
+        }
+    }
+    return -1;
+}
+
+// split the schedule into one queue per device, keeping the order of the schedule within each queue.
+// the queues of the devices of an earlier batch of the scan are kept with their readers and counts
+// entries: the entries of the monitored directory
+// files: the schedule (indices into entries)
+// cold: the number of uncached bytes of each file of the schedule
+void buildDeviceQueues(const vector<ScanEntry> &entries, const vector<size_t> &files, const vector<uint64_t> &cold)
+{
+    scheduler.queueOf.assign(entries.size(), nullptr);
+    scheduler.taken.assign(entries.size(), 0);
+    scheduler.nextQueue = 0;
+    map<dev_t, DeviceQueue *> queues;
+    for (auto &queue : scheduler.queues)
+    {
+        queue->files.clear();
+        queue->coldBytes.assign(1, 0);
+        queue->coldFiles.assign(1, 0);
+        queue->next = 0;
+        queue->readers = 0;
+        queue->prefetched = 0;
+        queues[queue->dev] = queue.get();
+    }
+    for (size_t n = 0; n < files.size(); n++)
+    {
+        dev_t dev = entries[files[n]].dev;
+        DeviceQueue *&queue = queues[dev];
+        if (queue == nullptr)
+        {
+            scheduler.queues.push_back(make_unique<DeviceQueue>());
+            queue = scheduler.queues.back().get();
+            queue->dev = dev;
+            queue->rotational = rotationalDevice(dev);
+            queue->maxReaders = scanOptions.deviceReaders > 0 ? scanOptions.deviceReaders
+                                : queue->rotational == 1      ? ROTATIONAL_READERS
+                                                              : DEVICE_READERS;
+            queue->coldBytes.push_back(0);
+            queue->coldFiles.push_back(0);
+        }
+        queue->files.push_back(files[n]);
+        queue->hashed++;
+        scheduler.queueOf[files[n]] = queue;
+        queue->coldBytes.push_back(queue->coldBytes.back() + cold[n]);
+        queue->coldFiles.push_back(queue->coldFiles.back() + (cold[n] > 0 ? 1 : 0));
+    }
+}
+
+// take the next file to be hashed without waiting. scheduler.lock must be held
+// queue: set to the queue of the file
+// file: set to the index of the file in the entries
+// returns 1 if a file was taken, 0 if all queues with files left are at their limit and -1 when all files are taken
+int pollQueues(DeviceQueue *&queue, size_t &file)
+{
+    bool remaining = false;
+    size_t count = scheduler.queues.size();
+    for (size_t k = 0; k < count; k++)
+    {
+        size_t q = (scheduler.nextQueue + k) % count;
+        DeviceQueue &candidate = *scheduler.queues[q];
+        // pass over the files already taken out of turn
+        while (candidate.next < candidate.files.size() && scheduler.taken[candidate.files[candidate.next]])
+        {
+            candidate.next++;
+        }
+        if (candidate.next >= candidate.files.size())
+        {
+            continue;
+        }
+        remaining = true;
+        if (candidate.readers < candidate.maxReaders)
+        {
+            queue = &candidate;
+            file = candidate.files[candidate.next++];
+            scheduler.taken[file] = 1;
+            candidate.readers++;
+            scheduler.nextQueue = (q + 1) % count;
+            return 1;
+        }
+    }
+    if (!remaining)
+    {
+        // wake up the paused threads, there is nothing left for them
+        {
+            lock_guard<mutex> throttleGuard(throttle.lock);
+            throttle.drained = true;
+        }
+        throttle.changed.notify_all();
+        return -1;
+    }
+    return 0;
+}
+
+// take the next file to be hashed. the device queues are visited round robin, and a queue is passed over
+// while as many files of its device are being hashed as it allows; if all queues with files left are at their limit,
+// the thread waits until a file is finished
+// queue: set to the queue of the file
+// file: set to the index of the file in the entries
+// returns false when all files are taken
+bool takeFile(DeviceQueue *&queue, size_t &file)
+{
+    unique_lock<mutex> guard(scheduler.lock);
+    int state;
+    while ((state = pollQueues(queue, file)) == 0)
+    {
+        scheduler.freed.wait(guard);
+    }
+    return state > 0;
+}
+
+// tell the scheduler that a file taken with takeFile was hashed
+// queue: the queue of the file
+void finishFile(DeviceQueue *queue)
+{
+    {
+        lock_guard<mutex> guard(scheduler.lock);
+        queue->readers--;
+    }
+    scheduler.freed.notify_all();
+}
+
+// get the name of a user, the user database is read once per user.
+// the owner cache is not locked, the caller serializes the calls
+// uid: the user id
+const string &ownerName(uid_t uid)
+{
+    auto owner = owners.users.find(uid);
+    if (owner == owners.users.end())
+    {
+        pw = getpwuid(uid);
+        owner = owners.users.emplace(uid, pw->pw_name).first;
+        account(MEM_OWNER_CACHE, sizeof(*owner) + owner->second.capacity());
+    }
+    owners.lookups++;
+    return owner->second;
+}
+
+// format access rights as in the verification file (octal)
+// mode: the mode of a file or directory
+string formatMode(mode_t mode)
+{
+    ostringstream oss;
+    oss << oct << (mode & (S_IRWXU | S_IRWXG | S_IRWXO));
+    return oss.str();
+}
+
+// format a time as in the verification file (UTC)
+// tt: the time
+string formatTime(time_t tt)
+{
+    tm gmt;
+    gmtime_r(&tt, &gmt);
+    char date[80];
+    strftime(date, sizeof(date), "%Y-%m-%d %H:%M:%S", &gmt);
+    return date;
+}
+
+// the message digest of a scanned entry as written to the verification file
+// entry: the scanned file or directory
+// returns the digest in hexadecimal, "directory" for directories (empty if it was not computed)
+string entryHash(const ScanEntry &entry)
+{
+    return entry.isDirectory ? "directory" : encodeHex(string((const char *)entry.digest, entry.digestSize));
+}
+
+// the warning about a file whose read failed
+// path: the path of the file
+// error: the errno of the read
+string readWarning(string_view path, int error)
+{
+    return string(path) + " can not be read: " + strerror(error);
+}
+
+// copy the message digest of a file (or the error of its read) to another path of the same file
+// link: the entry of the other path
+// first: the entry whose digest was computed
+void copyDigest(ScanEntry &link, const ScanEntry &first)
+{
+    link.readError = first.readError;
+    link.digestSize = first.digestSize;
+    memcpy(link.digest, first.digest, first.digestSize);
+}
+
+// create a tsv string for a file or directory
+// entry: the scanned file or directory
+string createTsvString(const ScanEntry &entry)
+{
+    // get the full path to file or directory
+    string line = entry.path + "\t";
+
+    // get the file size
+    line += to_string(entry.size) + "\t";
+
+    // get the name of the user owning the file or directory
+    const string &owner = ownerName(entry.uid);
+    line += owner;
+    line += "\t";
+
+    // the group column holds the name of the owner as well, as in the existing verification files
+    line += owner;
+    line += "\t";
+
+    // get the access rights of the file or directory
+    line += formatMode(entry.mode) + "\t";
+
+    // get the last modification date
+    line += formatTime(entry.mtime);
+    line += "\t";
+
+    // the message digest of files (using the hash function specified by the user), "directory" otherwise
+    line += entryHash(entry);
+    line += "\n";
+
+    return line;
+}
+
+// pass the lines of the entries that are next in path order and whose digest is known to the sink.
+// reorder.lock must be held (which also serializes the owner cache in createTsvString)
+void writeReadyLines()
+{
+    vector<ScanEntry> &entries = *reorder.entries;
+    while (reorder.next < entries.size() && reorder.complete[reorder.next])
+    {
+        size_t i = reorder.next++;
+        if (reorder.firstLink[i] != SIZE_MAX)
+        {
+            copyDigest(entries[i], entries[reorder.firstLink[i]]);
+        }
+        if (!reorder.withLines)
+        {
+            reorder.sink(entries[i], string());
+        }
+        else if (reorder.lines[i].empty())
+        {
+            reorder.sink(entries[i], createTsvString(entries[i]));
+        }
+        else
+        {
+            reorder.sink(entries[i], reorder.lines[i]);
+            reorder.bufferedBytes -= reorder.lines[i].size();
+            account(MEM_REORDER_BUFFER, -(int64_t)reorder.lines[i].size());
+            reorder.bufferedLines--;
+            string().swap(reorder.lines[i]);
+        }
+    }
+    reorder.written.notify_all();
+}
+
+// tell the reorder buffer that a file was hashed
+// file: the index of the file in the entries
+void completeEntry(size_t file)
+{
+    if (!reorder.sink)
+    {
+        return;
+    }
+    lock_guard<mutex> guard(reorder.lock);
+    reorder.complete[file] = 1;
+    if (file == reorder.next)
+    {
+        writeReadyLines();
+        return;
+    }
+    if (!reorder.withLines)
+    {
+        return;
+    }
+    reorder.lines[file] = createTsvString((*reorder.entries)[file]);
+    reorder.bufferedBytes += reorder.lines[file].size();
+    account(MEM_REORDER_BUFFER, reorder.lines[file].size());
+    reorder.peakBytes = max(reorder.peakBytes, reorder.bufferedBytes);
+    reorder.bufferedLines++;
+    reorder.peakLines = max(reorder.peakLines, reorder.bufferedLines);
+}
+
+// take the file that holds back the lines in the reorder buffer if the buffer is full, without waiting.
+// reorder.lock must be held
+// queue: set to the queue of the file
+// file: set to the index of the file in the entries
+// returns 1 if the file was taken, 0 if it is being hashed and -1 if the buffer is not full
+int pollHeadFile(DeviceQueue *&queue, size_t &file)
+{
+    // near the memory limit the lines are not left waiting
+    if (reorder.bufferedBytes <= resources.reorderBytes && (reorder.bufferedBytes == 0 || !memoryTight()))
+    {
+        return -1;
+    }
+
+    // only the files in the queues can be incomplete
+    lock_guard<mutex> schedulerGuard(scheduler.lock);
+    if (scheduler.taken[reorder.next])
+    {
+        return 0;
+    }
+    file = reorder.next;
+    queue = scheduler.queueOf[file];
+    scheduler.taken[file] = 1;
+    queue->readers++;
+    reorder.headDispatches++;
+    return 1;
+}
+
+// take the file that holds back the lines in the reorder buffer once the buffer is full.
+// if that file is already being hashed, the thread waits until its line was written
+// queue: set to the queue of the file
+// file: set to the index of the file in the entries
+// returns false if the buffer is not full
+bool takeHeadFile(DeviceQueue *&queue, size_t &file)
+{
+    if (!reorder.sink)
+    {
+        return false;
+    }
+    unique_lock<mutex> guard(reorder.lock);
+    int state;
+    while ((state = pollHeadFile(queue, file)) == 0)
+    {
+        auto stalled = chrono::steady_clock::now();
+        reorder.written.wait(guard);
+        reorder.stallNs += chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - stalled).count();
+    }
+    return state > 0;
+}
+
+// queue a slot of the async executor to be resumed by a hashing thread
+// handle: the slot
+void makeRunnable(coroutine_handle<> handle)
+{
+    {
+        lock_guard<mutex> guard(executor.lock);
+        executor.runnable.push_back(handle);
+    }
+    executor.resumable.notify_one();
+}
+
+// let the parked slots of the async executor try again to take a file
+void wakeParked()
+{
+    {
+        lock_guard<mutex> guard(executor.lock);
+        executor.wakeups++;
+        executor.runnable.insert(executor.runnable.end(), executor.parked.begin(), executor.parked.end());
+        executor.parked.clear();
+    }
+    executor.resumable.notify_all();
+}
+
+// awaiting a blocking call suspends the slot while the call is made by an io thread
+// and resumes it with the result of the call
+template <typename Call>
+struct BlockingCall
+{
+    Call call;                                 // the blocking call
+    decltype(declval<Call &>()()) result = {}; // the result of the call
+
+    bool await_ready() { return false; }
+    void await_suspend(coroutine_handle<> handle)
+    {
+        {
+            lock_guard<mutex> guard(executor.lock);
+            executor.calls.push_back([this, handle]
+                                     { result = call(); makeRunnable(handle); });
+        }
+        executor.called.notify_one();
+    }
+    auto await_resume() { return result; }
+};
+
+// make a blocking call on an io thread
+// call: the blocking call
+template <typename Call>
+BlockingCall<Call> onIoThread(Call call)
+{
+    return {call};
+}
+
+// awaiting the next file takes it as takeFile and takeHeadFile would, but parks the slot instead of
+// blocking the hashing thread when it would have to wait. a parked slot is woken up when a file was hashed
+struct NextFile
+{
+    DeviceQueue *&queue; // set to the queue of the file
+    size_t &file;        // set to the index of the file in the entries
+    int state = 0;       // 1 if a file was taken, 0 if the slot was parked, -1 when all files are taken
+
+    bool await_ready() { return false; }
+    bool await_suspend(coroutine_handle<> handle)
+    {
+        while (true)
+        {
+            uint64_t wakeups;
+            {
+                lock_guard<mutex> guard(executor.lock);
+                wakeups = executor.wakeups;
+            }
+            state = -1;
+            if (reorder.sink)
+            {
+                lock_guard<mutex> guard(reorder.lock);
+                state = pollHeadFile(queue, file);
+            }
+            if (state < 0)
+            {
+                lock_guard<mutex> guard(scheduler.lock);
+                state = pollQueues(queue, file);
+            }
+            if (state != 0)
+            {
+                return false;
+            }
+
+            // park the slot, unless a file was hashed in the meantime
+            lock_guard<mutex> guard(executor.lock);
+            if (executor.wakeups == wakeups)
+            {
+                executor.parked.push_back(handle);
+                return true;
+            }
+        }
+    }
+    int await_resume() { return state; }
+};
+
+// a slot of the async executor: hash one file after the other until all files are taken
+// entries: the entries of the monitored directory
+// hashF: the hash function to be used
+AsyncTask hashSlot(vector<ScanEntry> &entries, string hashF)
+{
+    auto buffer = allocateReadBuffer();
+    DeviceQueue *queue;
+    size_t file;
+    int state;
+    while ((state = co_await NextFile{queue, file}) >= 0)
+    {
+        // a parked slot tries again
+        if (state == 0)
+        {
+            continue;
+        }
+        prefetcher.progress.notify_one();
+        ScanEntry &entry = entries[file];
+
+        auto started = chrono::steady_clock::now();
+        FileDigest digest;
+        co_await onIoThread([&]
+                            { openDigest(digest, entry.path, hashF); return 0; });
+        if (digest.fd >= 0)
+        {
+            ssize_t n;
+            auto readStart = chrono::steady_clock::now();
+            while ((n = co_await onIoThread([&]
+                                            { return readChunk(digest, entry.path, buffer.get()); })) > 0)
+            {
+                prefetcher.readWaitNs += chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - readStart).count();
+                updateDigest(digest, buffer.get(), n);
+                readStart = chrono::steady_clock::now();
+            }
+        }
+        prefetcher.hashingNs += chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - started).count();
+        recordDigest(entry, hashF, finishDigest(digest), digest.error);
+
+        completeEntry(file);
+        finishFile(queue);
+        wakeParked();
+    }
+
+    // the hashing threads end with the last slot
+    {
+        lock_guard<mutex> guard(executor.lock);
+        executor.slots--;
+    }
+    executor.resumable.notify_all();
+}
+
+// hash the files with the slots of the async executor, the hashing threads and the io threads
+// entries: the entries of the monitored directory
+// hashF: the hash function to be used
+void runAsync(vector<ScanEntry> &entries, const string &hashF)
+{
+    executor.slots = scanOptions.async;
+    executor.ioDone = false;
+    for (unsigned n = 0; n < scanOptions.async; n++)
+    {
+        executor.runnable.push_back(hashSlot(entries, hashF).handle);
+    }
+
+    // the io threads make the blocking calls of the slots
+    auto ioThread = []
+    {
+        while (true)
+        {
+            function<void()> call;
+            {
+                unique_lock<mutex> guard(executor.lock);
+                executor.called.wait(guard, []
+                                     { return !executor.calls.empty() || executor.ioDone; });
+                if (executor.calls.empty())
+                {
+                    return;
+                }
+                call = move(executor.calls.front());
+                executor.calls.pop_front();
+                executor.ioCalls++;
+            }
+            call();
+        }
+    };
+    executor.ioThreads = min(scanOptions.async, ASYNC_MAX_IO_THREADS);
+    vector<thread> ioThreads;
+    for (unsigned t = 0; t < executor.ioThreads; t++)
+    {
+        ioThreads.emplace_back(ioThread);
+    }
+
+    // the hashing threads resume the slots whose calls returned
+    auto hashingThread = [](unsigned id)
+    {
+        startCpuCharge();
+        while ((waitForTurn(id), chargeCpu(), true))
+        {
+            coroutine_handle<> handle;
+            {
+                unique_lock<mutex> guard(executor.lock);
+                executor.resumable.wait(guard, []
+                                        { return !executor.runnable.empty() || executor.slots == 0; });
+                if (executor.runnable.empty())
+                {
+                    return;
+                }
+                handle = executor.runnable.front();
+                executor.runnable.pop_front();
+            }
+            handle.resume();
+        }
+    };
+    vector<thread> threads;
+    for (unsigned t = 1; t < resources.workers; t++)
+    {
+        threads.emplace_back(hashingThread, t);
+    }
+    hashingThread(0);
+    for (auto &t : threads)
+    {
+        t.join();
+    }
+
+    {
+        lock_guard<mutex> guard(executor.lock);
+        executor.ioDone = true;
+    }
+    executor.called.notify_all();
+    for (auto &t : ioThreads)
+    {
+        t.join();
+    }
+}
+
+// reorder the schedule so that the large files are hashed in decreasing size order (longest processing time first).
+// the small files keep their order and are spread evenly between the large ones, so that neighbouring small
+// files are still read together while the large files are dispatched early
+// entries: the entries of the monitored directory
+// files: the schedule (indices into entries)
+void scheduleLargestFirst(const vector<ScanEntry> &entries, vector<size_t> &files)
+{
+    vector<size_t> large;
+    vector<size_t> small;
+    for (size_t file : files)
+    {
+        (entries[file].size > LARGE_FILE_SIZE ? large : small).push_back(file);
+    }
+    stable_sort(large.begin(), large.end(), [&](size_t a, size_t b)
+                { return entries[a].size > entries[b].size; });
+
+    // emit each large file followed by its share of the small files
+    files.clear();
+    size_t nextSmall = 0;
+    for (size_t n = 0; n < large.size(); n++)
+    {
+        files.push_back(large[n]);
+        size_t smallEnd = small.size() * (n + 1) / large.size();
+        for (; nextSmall < smallEnd; nextSmall++)
+        {
+            files.push_back(small[nextSmall]);
+        }
+    }
+    files.insert(files.end(), small.begin() + nextSmall, small.end());
+}
+
+// compute the message digests of all files in entries.
+// files found in the hash cache are not read, and hard linked files are only read once.
+// in inode order mode the files are read window by window, sorted by device and physical position.
+// if reorder.sink is set, the lines of the entries are passed to it in the order of the entries while they are hashed
+// entries: the entries of the monitored directory
+// hashF: the hash function to be used
+void hashEntries(vector<ScanEntry> &entries, string hashF)
+{
+    // files with several hard links are only read through their first path
+    map<pair<dev_t, ino_t>, size_t> firstLinks; // key: device and inode, value: index of the first path
+    vector<pair<size_t, size_t>> links;          // further paths of a hard linked file and their first path
+
+    vector<size_t> files;
+    vector<size_t> deferred; // changed files that are hashed last
+    for (size_t i = 0; i < entries.size(); i++)
+    {
+        if (!entries[i].isDirectory && !lookupHashCache(entries[i], hashF))
+        {
+            // the digest of a file known to have changed is only needed for the report
+            if (entries[i].changed && scanOptions.changedHash == "skip")
+            {
+                continue;
+            }
+            if (S_ISREG(entries[i].mode) && entries[i].nlink > 1)
+            {
+                auto first = firstLinks.emplace(make_pair(entries[i].dev, entries[i].ino), i);
+                if (!first.second)
+                {
+                    links.push_back({i, first.first->second});
+                    continue;
+                }
+            }
+            (entries[i].changed && scanOptions.changedHash == "defer" ? deferred : files).push_back(i);
+        }
+    }
+
+    if (scanOptions.inodeOrder)
+    {
+        for (size_t start = 0; start < files.size(); start += EXTENT_WINDOW)
+        {
+            size_t end = min(start + EXTENT_WINDOW, files.size());
+            map<size_t, pair<dev_t, uint64_t>> keys;
+            for (size_t j = start; j < end; j++)
+            {
+                keys[files[j]] = {entries[files[j]].dev, readPosition(entries[files[j]])};
+            }
+            stable_sort(files.begin() + start, files.begin() + end, [&](size_t a, size_t b)
+                        { return keys[a] < keys[b]; });
+        }
+    }
+
+    if (scanOptions.largestFirst)
+    {
+        scheduleLargestFirst(entries, files);
+    }
+
+    // in cache first mode the files are probed for pages in the page cache. fully cached files are hashed first,
+    // followed by the partly cached and the uncached ones, which are prefetched in the meantime.
+    // without probing all files are assumed to be uncached
+    vector<uint64_t> cold(files.size());
+    for (size_t n = 0; n < files.size(); n++)
+    {
+        cold[n] = entries[files[n]].size;
+    }
+    if (scanOptions.cacheFirst)
+    {
+        vector<int> rank(files.size());
+        for (size_t n = 0; n < files.size(); n++)
+        {
+            uint64_t resident = residentBytes(entries[files[n]]);
+            rank[n] = cold[n] == resident ? 0 : resident > 0 ? 1 : 2;
+            scanStats.probedBytes += cold[n];
+            scanStats.residentBytes += resident;
+            cold[n] -= resident;
+        }
+
+        vector<size_t> order(files.size());
+        iota(order.begin(), order.end(), 0);
+        stable_sort(order.begin(), order.end(), [&](size_t a, size_t b)
+                    { return rank[a] < rank[b]; });
+        vector<size_t> scheduledFiles(files.size());
+        vector<uint64_t> scheduledCold(files.size());
+        for (size_t n = 0; n < files.size(); n++)
+        {
+            scheduledFiles[n] = files[order[n]];
+            scheduledCold[n] = cold[order[n]];
+        }
+        files = scheduledFiles;
+        cold = scheduledCold;
+    }
+
+    for (size_t file : deferred)
+    {
+        files.push_back(file);
+        cold.push_back(entries[file].size);
+    }
+
+    // every device gets its own queue
+    buildDeviceQueues(entries, files, cold);
+
+    // directories, cached and hard linked files are complete before the hashing starts
+    if (reorder.sink)
+    {
+        reorder.entries = &entries;
+        reorder.firstLink.assign(entries.size(), SIZE_MAX);
+        reorder.complete.assign(entries.size(), 1);
+        reorder.lines.assign(reorder.withLines ? entries.size() : 0, string());
+        reorder.next = 0;
+        for (const auto &[link, first] : links)
+        {
+            reorder.firstLink[link] = first;
+        }
+        for (size_t file : files)
+        {
+            reorder.complete[file] = 0;
+        }
+        lock_guard<mutex> guard(reorder.lock);
+        writeReadyLines();
+    }
+
+    // in background mode the number of running threads follows the pressure of the host
+    throttle.done = false;
+    throttle.drained = false;
+    thread monitor;
+    if (scanOptions.background)
+    {
+        monitor = thread(monitorPressure);
+    }
+
+    // an autotuned scan tunes the number of running threads and device readers while it runs
+    thread tuner;
+    if (scanOptions.autotune)
+    {
+        tuner = thread(autotuneScan);
+    }
+
+    // hash the files with the thread pool, each thread takes the next file of a device that has a reader left
+    auto worker = [&](unsigned id)
+    {
+        startCpuCharge();
+        DeviceQueue *queue;
+        size_t file;
+        while ((waitForTurn(id), chargeCpu(), takeHeadFile(queue, file) || takeFile(queue, file)))
+        {
+            prefetcher.progress.notify_one();
+            hashEntry(entries[file], hashF);
+            completeEntry(file);
+            finishFile(queue);
+        }
+    };
+
+    // prefetch the next files of the queue (prefetching would defeat the drop and direct page cache modes)
+    prefetcher.done = false;
+    thread prefetch;
+    if (scanOptions.prefetch != 0 && scanOptions.pageCache == "keep")
+    {
+        prefetch = thread(prefetchQueues, cref(entries));
+    }
+
+    if (scanOptions.async > 0)
+    {
+        runAsync(entries, hashF);
+    }
+    else
+    {
+        vector<thread> threads;
+        for (unsigned t = 1; t < resources.workers; t++)
+        {
+            threads.emplace_back(worker, t);
+        }
+        worker(0);
+        for (auto &t : threads)
+        {
+            t.join();
+        }
+    }
+
+    // stop the pressure monitor and the tuner
+    {
+        lock_guard<mutex> guard(throttle.lock);
+        throttle.done = true;
+    }
+    throttle.changed.notify_all();
+    if (monitor.joinable())
+    {
+        monitor.join();
+    }
+    if (tuner.joinable())
+    {
+        tuner.join();
+    }
+    if (prefetch.joinable())
+    {
+        {
+            lock_guard<mutex> guard(prefetcher.lock);
+            prefetcher.done = true;
+        }
+        prefetcher.progress.notify_all();
+        prefetch.join();
+    }
+
+    // (the reorder buffer already copied the digests, which its sink may be reading)
+    for (const auto &[link, first] : links)
+    {
+        if (!reorder.sink)
+        {
+            copyDigest(entries[link], entries[first]);
+        }
+        scanStats.linkedFiles++;
+        scanStats.linkedBytes += entries[link].size;
+    }
+}
+
+// set up the knobs of a scan: the device queues, the number of running hashing threads and the prefetch depth.
+// hashEntries keeps them from one batch of a spilled scan to the next, with what was tuned and counted.
+// the automatically tuned prefetch depth starts at one file per hashing thread
+void startScan()
+{
+    scheduler.queues.clear();
+    throttle.active = resources.running;
+    throttle.minActive = resources.running;
+    throttle.tuned = false;
+    prefetcher.depth = scanOptions.prefetch > 0 ? scanOptions.prefetch : resources.workers;
+    prefetcher.maxDepth = prefetcher.depth;
+}
+
+// scan the monitored directory: walk it, sort its entries by path and hash its files.
+// the entries are passed to reorder.sink in path order while the files are hashed
+// dirPath: the path to the monitored directory
+// entries: filled with the entries of the monitored directory in path order
+// walk: the directory records of the verification file, filled with the records of the listed directories
+// hashF: the hash function to be used
+// classify: called with the entries before they are hashed (may be empty)
+void scanDirectory(const string &dirPath, vector<ScanEntry> &entries, WalkState &walk, const string &hashF,
+                   const function<void(vector<ScanEntry> &)> &classify = nullptr)
+{
+    if (!scanOptions.hashCachePath.empty())
+    {
+        openHashCache(scanOptions.hashCachePath, scanOptions.hashCacheSize);
+    }
+    startScan();
+
+    auto walkStart = chrono::steady_clock::now();
+    walkDirectory(dirPath, entries, walk);
+
+    // the entries are passed on in path order, so that identical directories give identical verification files
+    // no matter in which order the directories are listed and the files hashed
+    sort(entries.begin(), entries.end(), [](const ScanEntry &a, const ScanEntry &b)
+         { return a.path < b.path; });
+    sort(walk.records.begin(), walk.records.end(), [](const DirRecord &a, const DirRecord &b)
+         { return a.path < b.path; });
+    if (classify)
+    {
+        classify(entries);
+    }
+    auto hashStart = chrono::steady_clock::now();
+    scanStats.walkSeconds = chrono::duration<double>(hashStart - walkStart).count();
+
+    hashEntries(entries, hashF);
+    scanStats.hashSeconds = chrono::duration<double>(chrono::steady_clock::now() - hashStart).count();
+    closeHashCache();
+}
+
+// scan the monitored directory in batches that fit into the memory budget: the entries of each batch are
+// sorted by path, hashed and written to a run file of their own (in the format of the verification file)
+// dirPath: the path to the monitored directory
+// walk: the state of the walk
+// hashF: the hash function to be used
+// runDir: the directory the run files are written to. the lines of files that can not be read have no hash,
+// but the errno of the read as an eighth field (see splitReadError)
+// fileNum, dirNum: set to the number of files and directories scanned
+// unreadableNum: set to the number of files that can not be read
+// returns the paths of the run files
+vector<string> spillScan(const string &dirPath, WalkState &walk, const string &hashF, const string &runDir, int &fileNum, int &dirNum,
+                         int &unreadableNum)
+{
+    if (!scanOptions.hashCachePath.empty())
+    {
+        openHashCache(scanOptions.hashCachePath, scanOptions.hashCacheSize);
+    }
+    startScan();
+
+    vector<string> runs;
+    double hashSeconds = 0;
+    walk.spillBytes = scanOptions.memoryBudget / SPILL_BUDGET_SHARE;
+    walk.spill = [&](vector<ScanEntry> &entries)
+    {
+        if (entries.empty())
+        {
+            return;
+        }
+        sort(entries.begin(), entries.end(), [](const ScanEntry &a, const ScanEntry &b)
+             { return a.path < b.path; });
+        auto hashStart = chrono::steady_clock::now();
+        hashEntries(entries, hashF);
+        hashSeconds += chrono::duration<double>(chrono::steady_clock::now() - hashStart).count();
+
+        runs.push_back(runDir + "/run" + to_string(runs.size()));
+        ofstream run(runs.back(), ios::out);
+        for (const auto &entry : entries)
+        {
+            string line = createTsvString(entry);
+            entry.isDirectory ? dirNum++ : fileNum++;
+            if (entry.readError != 0)
+            {
+                line.insert(line.size() - 1, "\t" + to_string(entry.readError));
+                unreadableNum++;
+            }
+            run << line;
+        }
+        if (!run.good())
+        {
+            cout << "The run file " << runs.back() << " can not be written" << endl;
+            exit(EXIT_FAILURE);
+        }
+        entries.clear();
+    };
+
+    auto walkStart = chrono::steady_clock::now();
+    vector<ScanEntry> entries;
+    walkDirectory(dirPath, entries, walk);
+    walk.spill(entries);
+    scanStats.hashSeconds = hashSeconds;
+    scanStats.walkSeconds = chrono::duration<double>(chrono::steady_clock::now() - walkStart).count() - hashSeconds;
+    closeHashCache();
+    return runs;
+}
+
+// describe the order in which the files are scanned
+string scanOrder()
+{
+    string order = scanOptions.inodeOrder ? "inode" : "directory";
+    if (scanOptions.largestFirst)
+    {
+        order += ", largest first";
+    }
+    if (scanOptions.cacheFirst)
+    {
+        order += ", cache first";
+    }
+    return order;
+}
+
+// write the statistics of the scan to the report file
+// rFile: the report file
+void writeScanReport(ofstream &rFile)
+{
+    rFile << "CPU Limit: " << resources.cpuLimit << " (" << resources.cpuSource << ")" << endl;
+    rFile << "Memory Limit (in bytes): " << resources.memoryLimit << " (" << resources.memorySource << ")" << endl;
+    if (scanOptions.autotune && scanOptions.jobs == 0 && !scanOptions.background)
+    {
+        rFile << "Hashing Threads: " << throttle.active << " (autotuned from " << resources.running << ", pool of " << resources.workers << ")" << endl;
+    }
+    else
+    {
+        rFile << "Hashing Threads: " << resources.workers << endl;
+    }
+    rFile << "Read Buffer Size (in bytes): " << resources.readBufferSize << endl;
+    if (scanOptions.async > 0)
+    {
+        rFile << "Async Executor: " << scanOptions.async << " files in flight (" << executor.ioThreads << " io threads, "
+              << executor.ioCalls << " blocking calls)" << endl;
+    }
+    rFile << "Reorder Buffer (in bytes): " << resources.reorderBytes << " (peak of " << reorder.peakBytes << " bytes in "
+          << reorder.peakLines << " lines, " << reorder.headDispatches << " files hashed out of turn)" << endl;
+    for (const auto &queue : scheduler.queues)
+    {
+        rFile << "Device " << major(queue->dev) << ":" << minor(queue->dev) << ": "
+              << (queue->rotational == 1 ? "rotational" : queue->rotational == 0 ? "non-rotational" : "not a block device")
+              << ", " << queue->maxReaders << (scanOptions.autotune && scanOptions.deviceReaders == 0 ? " readers (autotuned), " : " readers, ")
+              << queue->hashed << " files hashed" << endl;
+    }
+    if (scanOptions.maxReadRate > 0)
+    {
+        rFile << "Read Rate Limit (in bytes per second): " << scanOptions.maxReadRate << " (waited " << readBucket.waitedSeconds << " seconds)" << endl;
+    }
+    if (scanOptions.maxCpu > 0)
+    {
+        rFile << "CPU Budget: " << scanOptions.maxCpu << " (waited " << cpuBucket.waitedSeconds << " seconds)" << endl;
+    }
+    if (scanOptions.idleIo)
+    {
+        rFile << "IO Priority Class: idle" << endl;
+    }
+    if (scanOptions.prefetch != 0)
+    {
+        rFile << "Prefetch Depth (in files): " << (scanOptions.prefetch < 0 ? "auto, up to " : "") << prefetcher.maxDepth << endl;
+        rFile << "Time Spent Waiting For Reads (in seconds): " << prefetcher.readWaitNs / 1e9 << endl;
+    }
+    if (scanOptions.cacheFirst)
+    {
+        double ratio = scanStats.probedBytes > 0 ? 100.0 * scanStats.residentBytes / scanStats.probedBytes : 100;
+        rFile << "Page Cache Hit Ratio: " << fixed << setprecision(1) << ratio << defaultfloat << "% (" << scanStats.residentBytes << " of " << scanStats.probedBytes << " bytes cached before hashing)" << endl;
+    }
+    rFile << "Page Cache Mode: " << scanOptions.pageCache;
+    if (scanOptions.pageCache != "keep")
+    {
+        rFile << " (" << scanStats.directFiles << " files read with O_DIRECT, " << scanStats.droppedBytes << " bytes dropped after hashing)";
+    }
+    rFile << endl;
+    if (scanOptions.background)
+    {
+        rFile << "Time Spent Throttled (in seconds): " << throttle.throttledSeconds << " (down to " << throttle.minActive << " hashing threads)" << endl;
+    }
+    rFile << "Hard Linked Paths Not Read Again: " << scanStats.linkedFiles << " (" << scanStats.linkedBytes << " bytes saved)" << endl;
+
+    // the time spent in the stages of the scan (the times of the read and hash stages are summed over all threads)
+    uint64_t readNs = prefetcher.readWaitNs, hashingNs = prefetcher.hashingNs;
+    rFile << "Walk Stage (in seconds): " << scanStats.walkSeconds << endl;
+    rFile << "Owner Names Looked Up: " << owners.users.size() << " (for " << owners.lookups << " entries)" << endl;
+    rFile << "Read Stage (in thread seconds): " << readNs / 1e9 << endl;
+    rFile << "Hash Stage (in thread seconds): " << (hashingNs - min(readNs, hashingNs)) / 1e9 << endl;
+    rFile << "Hashing And Sink (in seconds): " << scanStats.hashSeconds << " (stalled " << reorder.stallNs / 1e9 << " thread seconds on a full reorder buffer)" << endl;
+
+    // the memory used (the accounted components are part of the resident memory)
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    rFile << "Peak Resident Memory (in bytes): " << (uint64_t)usage.ru_maxrss * 1024 << " (" << memory.tightSamples << " samples above "
+          << MEMORY_TIGHT_PERCENT << "% of the memory limit)" << endl;
+    rFile << "Peak Accounted Memory (in bytes):";
+    for (int component = 0; component < MEM_COMPONENTS; component++)
+    {
+        rFile << (component > 0 ? ", " : " ") << MEMORY_COMPONENT_NAMES[component] << " " << memory.peak[component];
+    }
+    rFile << endl;
+
+    if (hashCache.busy)
+    {
+        rFile << "Hash Cache: " << scanOptions.hashCachePath << " (in use by another run, not used)" << endl;
+    }
+    else if (!scanOptions.hashCachePath.empty())
+    {
+        rFile << "Hash Cache: " << scanOptions.hashCachePath << " (" << hashCache.hits << " hits, " << hashCache.misses << " misses)" << endl;
+    }
+}
+
+// the path of the file of directory records that belongs to a verification file
+// vFilePath: the path to the verification file
+string directoryRecordsPath(const string &vFilePath)
+{
+    return vFilePath + ".dirs";
+}
+
+// the size and modification time of a verification file, which its directory records were written for
+// vFilePath: the path to the verification file
+// returns an empty string if the file can not be stat-ed
+string verificationFileState(const string &vFilePath)
+{
+    struct stat st;
+    if (stat(vFilePath.c_str(), &st) != 0)
+    {
+        return "";
+    }
+    return to_string(st.st_size) + "\t" + to_string(toNanoseconds(st.st_mtim));
+}
+
+// write the records of the directories of a verification file to a file next to it.
+// they are kept out of the verification file, which only depends on the entries (inode numbers and
+// status change times differ between copies of a tree) and can be read by earlier releases
+// vFilePath: the path to the verification file, which is written completely
+// records: the records of the listed directories in path order
+void writeDirectoryRecords(const string &vFilePath, const vector<DirRecord> &records)
+{
+    ofstream dFile(directoryRecordsPath(vFilePath), ios::out);
+    dFile << "SIV Directory Records" << endl;
+    dFile << verificationFileState(vFilePath) << endl;
+    for (const auto &record : records)
+    {
+        dFile << record.path << "\t" << record.ino << "\t" << record.mtimeNs << "\t" << record.ctimeNs << "\t" << record.childCount << endl;
+    }
+}
+
+// initialize the monitoring of a directory.
+// dirPath: the path to the directory to be monitored
+// vFilePath: the path to the verification file
+// rFile: the path to the report file
+// hashF: the hash function to be used
+void initialize(string dirPath, string vFilePath, string rFilePath, string hashF)
+{
+    // start a timer to measure the time of initialization
+    auto start = chrono::high_resolution_clock::now();
+
+    // make sure that specified directory exists
+    if (!fs::exists(dirPath))
+    {
+        cout << "The specified of directory does not exist" << endl;
+        exit(EXIT_FAILURE);
+    }
+
+    // make sure that the verification file is not inside the monitored directory
+    if (vFilePath.find(dirPath) != string::npos)
+    {
+        cout << "The path of verification file is inside the monitored directory" << endl;
+        exit(EXIT_FAILURE);
+    }
+    // make sure that the report file is not inside the monitored directory
+    if (rFilePath.find(dirPath) != string::npos)
+    {
+        cout << "The path of report file is inside the monitored directory" << endl;
+        exit(EXIT_FAILURE);
+    }
+    // make sure that the hash cache file is not inside the monitored directory
+    if (!scanOptions.hashCachePath.empty() && scanOptions.hashCachePath.find(dirPath) != string::npos)
+    {
+        cout << "The path of hash cache file is inside the monitored directory" << endl;
+        exit(EXIT_FAILURE);
+    }
+    // make sure that the path of verification file is not the same as the path of report file
+    if (vFilePath == rFilePath)
+    {
+        cout << "The path of verification file is the same as the path of report file" << endl;
+        exit(EXIT_FAILURE);
+    }
+
+    // make sure that the report file is a text file with .txt extension
+    if (rFilePath.find(".txt") == string::npos)
+    {
+        cout << "The report file is not a text file with .txt extension" << endl;
+        exit(EXIT_FAILURE);
+    }
+
+    // create the verification file
+    ofstream vFile;
+    vFile.open(vFilePath, ios::out);
+    int fileNum = 0;
+    int dirNum = 0;
+
+    // write the header of the verification file
+    vFile << VERIFICATION_FILE_TITLE << endl;
+    vFile << "Directory: " << dirPath << endl;
+    vFile << "Hash Function: " << hashF << endl;
+    vFile << "File Name\tFile Size\tOwner\tGroup\tAccess Rights\tLast Modified\tHash" << endl;
+
+    // read the directory and compute the message digests of its files.
+    // the tsv strings of the files and directories are written to the verification file while they are hashed
+    // files that can not be read are left out, they are reported as new by the next verification
+    vector<ScanEntry> entries;
+    WalkState walk;
+    vector<string> unreadable;
+    reorder.sink = [&](const ScanEntry &entry, const string &line)
+    {
+        if (entry.readError != 0)
+        {
+            unreadable.push_back(readWarning(entry.path, entry.readError));
+            return;
+        }
+        vFile << line;
+    };
+    scanDirectory(dirPath, entries, walk, hashF);
+    for (const string &warning : unreadable)
+    {
+        cout << "The file " << warning << ", it is left out of the verification file" << endl;
+    }
+
+    for (const auto &entry : entries)
+    {
+        // count the number of files and directories
+        if (entry.isDirectory)
+        {
+            dirNum++;
+        }
+        else
+        {
+            fileNum++;
+        }
+    }
+
+    // write the records of the directories, so that verification can skip listing the unchanged ones
+    vFile.close();
+    writeDirectoryRecords(vFilePath, walk.records);
+
+    // create the report file
+    ofstream rFile;
+    rFile.open(rFilePath, ios::out);
+    rFile << "SIV Report File" << endl;
+    rFile << "Directory: " << dirPath << endl;
+    rFile << "Verification File: " << vFilePath << endl;
+    rFile << "Number of parsed Files: " << fileNum << endl;
+    rFile << "Number of parsed Directories: " << dirNum << endl;
+    rFile << "Hash Function: " << hashF << endl;
+    rFile << "Number of Unreadable Files (left out of the verification file): " << unreadable.size() << endl;
+    for (const string &warning : unreadable)
+    {
+        rFile << warning << endl;
+    }
+    rFile << "Scan Order: " << scanOrder() << endl;
+    writeScanReport(rFile);
+    string seconds = to_string(chrono::duration_cast<chrono::seconds>(chrono::high_resolution_clock::now() - start).count());
+    rFile << "Time of Initialization (in seconds): " << seconds << endl;
+    rFile.close();
+}
+
+// get the index of a name in the names of an entry table, adding the name if it is new
+// table: the entry table
+// name: the name of an owner or group
+uint32_t internName(EntryTable &table, string_view name)
+{
+    auto known = table.nameIndex.find(name);
+    if (known == table.nameIndex.end())
+    {
+        known = table.nameIndex.emplace(string(name), table.names.size()).first;
+        table.names.push_back(string(name));
+    }
+    return known->second;
+}
+
+// get the path of an entry of an entry table
+// table: the entry table
+// i: the index of the entry
+string_view tablePath(const EntryTable &table, size_t i)
+{
+    uint64_t start = i == 0 ? 0 : table.pathEnd[i - 1];
+    return string_view(table.arena).substr(start, table.pathEnd[i] - start);
+}
+
+// hash a path of an entry table, keyed by the seed of the table so that no paths can be chosen to collide
+// table: the entry table
+// path: the path
+uint64_t pathHash(const EntryTable &table, string_view path)
+{
+    uint64_t hash = mix64(table.seed ^ path.size());
+    for (size_t k = 0; k < path.size(); k += sizeof(uint64_t))
+    {
+        uint64_t word = 0;
+        memcpy(&word, path.data() + k, min(sizeof(uint64_t), path.size() - k));
+        hash = mix64(hash ^ word);
+    }
+    return hash;
+}
+
+// insert a row of an entry table into a path index. a path that is already indexed keeps its first row
+// table: the entry table
+// index: the path index
+// row: the row of the entry table
+void indexPath(const EntryTable &table, PathIndex &index, uint32_t row)
+{
+    string_view path = tablePath(table, row);
+    uint64_t hash = pathHash(table, path);
+    PathShard &shard = index.shards[hash >> (64 - PATH_INDEX_SHARD_BITS)];
+    lock_guard<mutex> guard(shard.lock);
+
+    // keep the shard at most half full
+    if (2 * (shard.used + 1) > shard.slots.size())
+    {
+        vector<uint32_t> slots(max<size_t>(2 * shard.slots.size(), 16));
+        for (uint32_t slot : shard.slots)
+        {
+            if (slot != 0)
+            {
+                size_t k = pathHash(table, tablePath(table, slot - 1)) & (slots.size() - 1);
+                for (; slots[k] != 0; k = (k + 1) & (slots.size() - 1))
+                {
+                }
+                slots[k] = slot;
+            }
+        }
+        shard.slots.swap(slots);
+    }
+
+    size_t k = hash & (shard.slots.size() - 1);
+    for (; shard.slots[k] != 0; k = (k + 1) & (shard.slots.size() - 1))
+    {
+        if (tablePath(table, shard.slots[k] - 1) == path)
+        {
+            return;
+        }
+    }
+    shard.slots[k] = row + 1;
+    shard.used++;
+}
+
+// split a number of items into consecutive ranges, one per thread of the pool, and process them in parallel
+// count: the number of items
+// function: called with the first and the end of a range and the index of the range
+// returns the number of ranges
+size_t forEachRange(size_t count, const function<void(size_t, size_t, size_t)> &function)
+{
+    size_t rangeCount = clamp<size_t>(count / PARTITION_MIN, 1, resources.workers);
+    vector<thread> threads;
+    for (size_t r = 0; r < rangeCount; r++)
+    {
+        threads.emplace_back(function, r * count / rangeCount, (r + 1) * count / rangeCount, r);
+    }
+    for (auto &t : threads)
+    {
+        t.join();
+    }
+    return rangeCount;
+}
+
+// index all rows of an entry table, on the threads of the pool
+// table: the entry table
+// index: the path index, which is created
+void indexPaths(const EntryTable &table, PathIndex &index)
+{
+    size_t rows = table.pathEnd.size();
+    size_t shardCount = size_t(1) << PATH_INDEX_SHARD_BITS;
+    index.shards = make_unique<PathShard[]>(shardCount);
+    index.seen = make_unique<atomic<bool>[]>(rows);
+    size_t capacity = 16;
+    for (; capacity < 4 * rows / shardCount; capacity *= 2)
+    {
+    }
+    for (size_t k = 0; k < shardCount; k++)
+    {
+        index.shards[k].slots.resize(capacity);
+    }
+    forEachRange(rows, [&](size_t first, size_t end, size_t)
+                 {
+                     for (size_t row = first; row < end; row++)
+                     {
+                         indexPath(table, index, row);
+                     } });
+
+    int64_t bytes = rows * sizeof(atomic<bool>) + shardCount * sizeof(PathShard);
+    for (size_t k = 0; k < shardCount; k++)
+    {
+        bytes += index.shards[k].slots.capacity() * sizeof(uint32_t);
+    }
+    account(MEM_PATH_INDEX, bytes);
+}
+
+// find the row of a path in a path index
+// table: the entry table
+// index: the path index
+// path: the path
+// returns the row, -1 if the path is not indexed
+int64_t findPath(const EntryTable &table, PathIndex &index, string_view path)
+{
+    uint64_t hash = pathHash(table, path);
+    PathShard &shard = index.shards[hash >> (64 - PATH_INDEX_SHARD_BITS)];
+    lock_guard<mutex> guard(shard.lock);
+    for (size_t k = hash & (shard.slots.size() - 1); shard.slots[k] != 0; k = (k + 1) & (shard.slots.size() - 1))
+    {
+        if (tablePath(table, shard.slots[k] - 1) == path)
+        {
+            return shard.slots[k] - 1;
+        }
+    }
+    return -1;
+}
+
+// mark the row of a path as seen by the scan
+// index: the path index
+// row: the row of the entry table
+// returns false if the row was already seen
+bool markSeen(PathIndex &index, uint32_t row)
+{
+    return !index.seen[row].exchange(true, memory_order_relaxed);
+}
+
+// parse an unsigned number
+// text: the number
+// base: 8 or 10
+// value: set to the number
+// returns false if text is not a number
+template <typename T>
+bool parseNumber(string_view text, int base, T &value)
+{
+    auto [end, error] = from_chars(text.data(), text.data() + text.size(), value, base);
+    return !text.empty() && error == errc() && end == text.data() + text.size();
+}
+
+// parse a time as written to the verification file (UTC)
+// text: the time
+// tt: set to the time
+// returns false if text is not a time
+bool parseTime(string_view text, time_t &tt)
+{
+    tm date = {};
+    if (text.size() != 19 || text[4] != '-' || text[7] != '-' || text[10] != ' ' || text[13] != ':' || text[16] != ':' ||
+        !parseNumber(text.substr(0, 4), 10, date.tm_year) || !parseNumber(text.substr(5, 2), 10, date.tm_mon) ||
+        !parseNumber(text.substr(8, 2), 10, date.tm_mday) || !parseNumber(text.substr(11, 2), 10, date.tm_hour) ||
+        !parseNumber(text.substr(14, 2), 10, date.tm_min) || !parseNumber(text.substr(17, 2), 10, date.tm_sec))
+    {
+        return false;
+    }
+
+    // the fields must be in range, timegm would move them into the next month, day, hour or minute
+    static const int MONTH_DAYS[] = {31, 29, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+    bool leap = date.tm_year % 4 == 0 && (date.tm_year % 100 != 0 || date.tm_year % 400 == 0);
+    if (date.tm_mon < 1 || date.tm_mon > 12 || date.tm_mday < 1 || date.tm_mday > MONTH_DAYS[date.tm_mon - 1] ||
+        (date.tm_mon == 2 && date.tm_mday == 29 && !leap) || date.tm_hour > 23 || date.tm_min > 59 || date.tm_sec > 60)
+    {
+        return false;
+    }
+    date.tm_year -= 1900;
+    date.tm_mon -= 1;
+    tt = timegm(&date);
+    return true;
+}
+
+// decode a message digest in hexadecimal (as written by HexEncoder) into a column of an entry table
+// hash: the message digest in hexadecimal
+// digest: receives the binary message digest
+// size: the size of the binary message digest
+// returns false if hash is not a message digest of this size
+bool decodeDigest(string_view hash, uint8_t *digest, size_t size)
+{
+    // the value of each hexadecimal digit, 16 for the other characters
+    static const array<uint8_t, 256> values = []
+    {
+        array<uint8_t, 256> values;
+        values.fill(16);
+        for (int c = 0; c < 10; c++)
+        {
+            values['0' + c] = c;
+        }
+        for (int c = 0; c < 6; c++)
+        {
+            values['A' + c] = values['a' + c] = 10 + c;
+        }
+        return values;
+    }();
+
+    if (hash.size() != 2 * size)
+    {
+        return false;
+    }
+    uint8_t invalid = 0;
+    for (size_t k = 0; k < size; k++)
+    {
+        uint8_t high = values[(uint8_t)hash[2 * k]];
+        uint8_t low = values[(uint8_t)hash[2 * k + 1]];
+        invalid |= high | low;
+        digest[k] = high << 4 | low;
+    }
+    return invalid < 16;
+}
+
+// find the next tab or newline with AVX2, 32 bytes at a time
+// p: the start of the search
+// end: the end of the search
+// returns the position of the tab or newline, or end
+#ifdef __x86_64__
+__attribute__((target("avx2"))) const char *findDelimiterAvx2(const char *p, const char *end)
+{
+    const __m256i tab = _mm256_set1_epi8('\t');
+    const __m256i newline = _mm256_set1_epi8('\n');
+    for (; end - p >= 32; p += 32)
+    {
+        __m256i chunk = _mm256_loadu_si256((const __m256i *)p);
+        unsigned mask = _mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(chunk, tab), _mm256_cmpeq_epi8(chunk, newline)));
+        if (mask != 0)
+        {
+            return p + __builtin_ctz(mask);
+        }
+    }
+    while (p < end && *p != '\t' && *p != '\n')
+    {
+        p++;
+    }
+    return p;
+}
+#endif
+
+// find the next tab or newline with SSE2 (which every x86-64 cpu has), 16 bytes at a time,
+// and byte by byte on other cpus
+// p: the start of the search
+// end: the end of the search
+// returns the position of the tab or newline, or end
+const char *findDelimiterSse2(const char *p, const char *end)
+{
+#ifdef __x86_64__
+    const __m128i tab = _mm_set1_epi8('\t');
+    const __m128i newline = _mm_set1_epi8('\n');
+    for (; end - p >= 16; p += 16)
+    {
+        __m128i chunk = _mm_loadu_si128((const __m128i *)p);
+        unsigned mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(chunk, tab), _mm_cmpeq_epi8(chunk, newline)));
+        if (mask != 0)
+        {
+            return p + __builtin_ctz(mask);
+        }
+    }
+#endif
+    while (p < end && *p != '\t' && *p != '\n')
+    {
+        p++;
+    }
+    return p;
+}
+
+// the search for tabs and newlines used on this cpu
+const char *(*findDelimiter)(const char *, const char *) = findDelimiterSse2;
+
+// a chunk of the verification file parsed by one thread. the entries are written to the rows of the
+// entry table starting at firstRow, their paths and the names of their owners and groups to local
+// (whose columns are not used) until they are appended to the table
+struct ParsedChunk
+{
+    string_view text;          // the lines of the chunk
+    size_t lines;              // the number of lines of the chunk
+    size_t firstRow;           // the first row of the entry table written (one row per line is reserved)
+    size_t rows = 0;           // the number of rows written
+    EntryTable local;          // the paths and names of the entries written
+    string_view badLine;       // the first malformed line (data() is nullptr if there is none)
+};
+
+// parse an entry of the verification file into a row of an entry table
+// table: the entry table
+// row: the row
+// fields: the fields of the tsv string of the entry
+// local: receives the path and the names of owner and group of the entry
+// returns false if a field is malformed
+bool parseEntry(EntryTable &table, size_t row, const string_view fields[7], EntryTable &local)
+{
+    time_t mtime;
+    bool directory = fields[6] == "directory";
+    uint8_t *digest = &table.digests[row * table.digestSize];
+    if (!parseNumber(fields[1], 10, table.size[row]) || !parseNumber(fields[4], 8, table.mode[row]) || table.mode[row] > 0777 ||
+        !parseTime(fields[5], mtime) || !(directory ? (memset(digest, 0, table.digestSize), true) : decodeDigest(fields[6], digest, table.digestSize)))
+    {
+        return false;
+    }
+    table.mtime[row] = mtime;
+    table.isDirectory[row] = directory;
+    local.arena += fields[0];
+    table.pathEnd[row] = local.arena.size();
+    table.owner[row] = internName(local, fields[2]);
+    table.group[row] = internName(local, fields[3]);
+    return true;
+}
+
+// parse a chunk of the verification file, consisting of whole lines.
+// the pages of the mapping that were parsed are released as the parsing goes on
+// table: the entry table
+// parsed: the chunk
+void parseChunk(EntryTable &table, ParsedChunk &parsed)
+{
+    const char *p = parsed.text.data();
+    const char *end = p + parsed.text.size();
+    uintptr_t pageSize = sysconf(_SC_PAGESIZE);
+    uintptr_t released = ((uintptr_t)p + pageSize - 1) & ~(pageSize - 1);
+    while (p < end)
+    {
+        // split the line into its fields
+        string_view fields[7];
+        size_t count = 0;
+        const char *line = p;
+        const char *delimiter;
+        do
+        {
+            delimiter = findDelimiter(p, end);
+            if (count < 7)
+            {
+                fields[count] = string_view(p, delimiter - p);
+            }
+            count++;
+            p = delimiter + 1;
+        } while (delimiter < end && *delimiter == '\t');
+
+        if (count != 7 || !parseEntry(table, parsed.firstRow + parsed.rows, fields, parsed.local))
+        {
+            parsed.badLine = string_view(line, min(delimiter, end) - line);
+            return;
+        }
+        else
+        {
+            parsed.rows++;
+        }
+
+        // the parsed pages are read again from the file if they are needed
+        uintptr_t parsedPages = (uintptr_t)min(p, end) & ~(pageSize - 1);
+        if (parsedPages >= released + PARSE_CHUNK_MIN)
+        {
+            madvise((void *)released, parsedPages - released, MADV_DONTNEED);
+            released = parsedPages;
+        }
+    }
+}
+
+// read the directory records of a verification file. the records are not used if the verification file
+// was written again after them (e.g. by an earlier release), and malformed records are ignored:
+// their directories are listed again
+// vFilePath: the path to the verification file
+// walk: receives the directory records
+void loadDirectoryRecords(const string &vFilePath, WalkState &walk)
+{
+    ifstream dFile(directoryRecordsPath(vFilePath), ios::in);
+    string line;
+    if (!getline(dFile, line) || line != "SIV Directory Records" || !getline(dFile, line) || line != verificationFileState(vFilePath))
+    {
+        return;
+    }
+    while (getline(dFile, line))
+    {
+        // path, inode number, modification time, status change time and number of entries
+        vector<string_view> fields;
+        for (size_t start = 0; start <= line.size();)
+        {
+            size_t end = min(line.find('\t', start), line.size());
+            fields.push_back(string_view(line).substr(start, end - start));
+            start = end + 1;
+        }
+        DirRecord record;
+        if (fields.size() == 5 && parseNumber(fields[1], 10, record.ino) && parseNumber(fields[2], 10, record.mtimeNs) &&
+            parseNumber(fields[3], 10, record.ctimeNs) && parseNumber(fields[4], 10, record.childCount))
+        {
+            record.path = fields[0];
+            walk.known[record.path] = record;
+        }
+    }
+}
+
+// read the entries of the verification file. the file is mapped into memory and split into chunks
+// of whole lines, which are parsed by the threads of the pool straight into the rows of the table
+// (each chunk gets a row per line)
+// vFilePath: the path to the verification file
+// offset: the position of the first entry (after the header)
+// table: receives the entries (table.digestSize and table.seed must be set)
+// returns the error message, or an empty string if the file was loaded
+string loadVerificationFile(const string &vFilePath, uint64_t offset, EntryTable &table)
+{
+#ifdef __x86_64__
+    if (__builtin_cpu_supports("avx2"))
+    {
+        findDelimiter = findDelimiterAvx2;
+    }
+#endif
+
+    int fd = open(vFilePath.c_str(), O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0)
+    {
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+        return "The verification file can not be read";
+    }
+    if ((uint64_t)st.st_size <= offset)
+    {
+        close(fd);
+        return "";
+    }
+    char *data = (char *)mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+    {
+        return "The verification file can not be read";
+    }
+    madvise(data, st.st_size, MADV_SEQUENTIAL);
+    string_view body(data + offset, st.st_size - offset);
+
+    // split the entries into chunks that end at a newline
+    size_t chunkCount = clamp<size_t>(body.size() / PARSE_CHUNK_MIN, 1, resources.workers);
+    vector<ParsedChunk> parsed;
+    for (size_t start = 0; start < body.size();)
+    {
+        size_t end = parsed.size() + 1 == chunkCount ? body.size() : (parsed.size() + 1) * body.size() / chunkCount;
+        end = end < body.size() ? body.find('\n', end) : body.size();
+        end = end == string_view::npos ? body.size() : end + 1;
+        parsed.emplace_back();
+        parsed.back().text = body.substr(start, end - start);
+        start = end;
+    }
+
+    // run a function for each chunk on a thread of its own
+    auto forEachChunk = [&](auto function)
+    {
+        vector<thread> threads;
+        for (auto &chunk : parsed)
+        {
+            threads.emplace_back(function, ref(chunk));
+        }
+        for (auto &t : threads)
+        {
+            t.join();
+        }
+    };
+
+    // reserve a row for each line
+    forEachChunk([](ParsedChunk &chunk)
+                 { chunk.lines = count(chunk.text.begin(), chunk.text.end(), '\n') + (chunk.text.back() != '\n'); });
+    size_t rows = 0;
+    for (auto &chunk : parsed)
+    {
+        chunk.firstRow = rows;
+        rows += chunk.lines;
+    }
+    table.pathEnd.resize(rows);
+    table.size.resize(rows);
+    table.mtime.resize(rows);
+    table.mode.resize(rows);
+    table.owner.resize(rows);
+    table.group.resize(rows);
+    table.isDirectory.resize(rows);
+    table.digests.resize(rows * table.digestSize);
+
+    forEachChunk([&](ParsedChunk &chunk)
+                 { parseChunk(table, chunk); });
+    for (auto &chunk : parsed)
+    {
+        if (chunk.badLine.data() != nullptr)
+        {
+            string error = "The verification file is corrupted: " + string(chunk.badLine);
+            munmap(data, st.st_size);
+            return error;
+        }
+    }
+    munmap(data, st.st_size);
+
+    // append the paths and names of the chunks to the table in the order of the file
+    vector<uint64_t> arenaStart;
+    vector<vector<uint32_t>> names;
+    for (auto &chunk : parsed)
+    {
+        arenaStart.push_back(table.arena.size());
+        table.arena += chunk.local.arena;
+        string().swap(chunk.local.arena);
+        names.emplace_back();
+        for (const string &name : chunk.local.names)
+        {
+            names.back().push_back(internName(table, name));
+        }
+    }
+
+    // the rows of the chunks refer to their own paths and names
+    forEachChunk([&](ParsedChunk &chunk)
+                 {
+                     size_t c = &chunk - &parsed[0];
+                     for (size_t row = chunk.firstRow; row < chunk.firstRow + chunk.rows; row++)
+                     {
+                         table.pathEnd[row] += arenaStart[c];
+                         table.owner[row] = names[c][table.owner[row]];
+                         table.group[row] = names[c][table.group[row]];
+                     } });
+
+    int64_t bytes = table.arena.capacity() + table.digests.capacity() + table.isDirectory.capacity() +
+                    table.mode.capacity() * sizeof(uint16_t) + (table.owner.capacity() + table.group.capacity()) * sizeof(uint32_t) +
+                    (table.pathEnd.capacity() + table.size.capacity() + table.mtime.capacity()) * sizeof(uint64_t);
+    for (const string &name : table.names)
+    {
+        bytes += 2 * (sizeof(string) + name.capacity());
+    }
+    account(MEM_ENTRY_TABLE, bytes);
+    return "";
+}
+
+// the fields compared in verification, from the cheapest to the most expensive
+enum CompareField
+{
+    FIELD_TYPE,
+    FIELD_SIZE,
+    FIELD_MODE,
+    FIELD_OWNER,
+    FIELD_MTIME,
+    FIELD_HASH,
+    FIELD_COUNT
+};
+const char *COMPARE_FIELD_NAMES[] = {"type", "size", "access rights", "owner", "last modified time", "hash"};
+
+// compare the last modification time of a scanned entry with an entry of an entry table
+// table: the entry table
+// i: the index of the entry in the table
+// entry: the scanned file or directory
+// returns true if the times are the same, as written by the release that wrote the verification file
+bool sameMtime(const EntryTable &table, size_t i, const ScanEntry &entry)
+{
+    return table.mtime[i] == entry.mtime || (table.legacyTimes && entry.mtimeNsec < LEGACY_TIME_SKEW_NS && table.mtime[i] + 1 == entry.mtime);
+}
+
+// compare the fields of a scanned entry that are known before hashing with an entry of an entry table,
+// from the cheapest to the most expensive, until one differs
+// table: the entry table
+// i: the index of the entry in the table
+// entry: the scanned file or directory
+// owner: the name of the owner of the scanned entry in the table
+// evaluated: the number of entries each field was compared for, counted up
+// returns the first field that differs (FIELD_HASH if none does)
+CompareField firstChangedField(const EntryTable &table, size_t i, const ScanEntry &entry, uint32_t owner, uint64_t evaluated[])
+{
+    int field = FIELD_TYPE;
+    for (; field < FIELD_HASH; field++)
+    {
+        evaluated[field]++;
+        bool same = true;
+        switch (field)
+        {
+        case FIELD_TYPE:
+            same = (bool)table.isDirectory[i] == entry.isDirectory;
+            break;
+        case FIELD_SIZE:
+            same = table.size[i] == entry.size;
+            break;
+        case FIELD_MODE:
+            same = table.mode[i] == (entry.mode & (S_IRWXU | S_IRWXG | S_IRWXO));
+            break;
+        case FIELD_OWNER:
+            // the group column holds the name of the owner
+            same = table.owner[i] == owner && table.group[i] == owner;
+            break;
+        case FIELD_MTIME:
+            same = sameMtime(table, i, entry);
+            break;
+        }
+        if (!same)
+        {
+            break;
+        }
+    }
+    return (CompareField)field;
+}
+
+// compare the message digest of a scanned entry with an entry of an entry table.
+// the other fields were compared by firstChangedField before hashing, so that no fingerprint of all fields
+// is kept: it would cost more to compute for each scanned entry than comparing the digest it would stand for.
+// the fields that differ are found by writeChangedFields
+// table: the entry table
+// i: the index of the entry in the table
+// entry: the scanned file or directory, whose other fields are the same
+// returns true if the digests are the same (or both entries are directories)
+bool sameDigest(const EntryTable &table, size_t i, const ScanEntry &entry)
+{
+    if (entry.isDirectory)
+    {
+        return true;
+    }
+    return entry.digestSize == table.digestSize && memcmp(entry.digest, &table.digests[i * table.digestSize], table.digestSize) == 0;
+}
+
+// write the warnings about the fields of a changed file or directory to the report file
+// rFile: the report file (or a part of it)
+// table: the entry table of the verification file
+// i: the index of the entry in the table
+// entry: the scanned file or directory
+// ownerId: the name of the owner of the scanned entry in the table
+void writeChangedFields(ostream &rFile, const EntryTable &table, size_t i, const ScanEntry &entry, uint32_t ownerId)
+{
+    string_view fileName = tablePath(table, i);
+
+    // compare the file size
+    if (table.size[i] != entry.size)
+    {
+        rFile << fileName << " file size is different: " << table.size[i] << " " << entry.size << endl;
+    }
+
+    // compare the owner
+    const string &owner = table.names[ownerId];
+    if (table.names[table.owner[i]] != owner)
+    {
+        rFile << fileName << " owner is different: " << table.names[table.owner[i]] << " " << owner << endl;
+    }
+
+    // compare the group (the name of the owner)
+    if (table.names[table.group[i]] != owner)
+    {
+        rFile << fileName << " group is different: " << table.names[table.group[i]] << " " << owner << endl;
+    }
 
-    pw = getpwuid(info.st_uid);
-    line += pw->pw_name;
-    line += "\t";
+    // compare the access rights
+    if (table.mode[i] != (entry.mode & (S_IRWXU | S_IRWXG | S_IRWXO)))
+    {
+        rFile << fileName << " access rights are different: " << formatMode(table.mode[i]) << " " << formatMode(entry.mode) << endl;
+    }
 
-    // get the name of the group owning the file or directory
-    gr = getgrgid(info.st_gid);
-    line += pw->pw_name;
-    line += "\t";
+    // compare the last modified time
+    if (!sameMtime(table, i, entry))
+    {
+        rFile << fileName << " last modified time is different: " << formatTime(table.mtime[i]) << " " << formatTime(entry.mtime) << endl;
+    }
 
-    // get the access rights of the file or directory
+    // compare the hash (unless it was not computed because of the fields above, or the file could not be read)
+    if (entry.readError != 0)
+    {
+        return;
+    }
+    string hash = table.isDirectory[i] ? "directory" : encodeHex(string((const char *)&table.digests[i * table.digestSize], table.digestSize));
+    string actual = entryHash(entry);
+    if (actual.empty())
+    {
+        rFile << fileName << " hash was not computed: other fields are different" << endl;
+    }
+    else if (hash != actual)
+    {
+        rFile << fileName << " hash is different: " << hash << " " << actual << endl;
+    }
+}
 
-    int statchmod = info.st_mode & (S_IRWXU | S_IRWXG | S_IRWXO);
-    ostringstream oss;
-    oss << oct << statchmod;
-    line += oss.str() + "\t";
+// a file of entry lines in path order: a run file of a spilled scan or the verification file
+struct RunReader
+{
+    ifstream file;     // the file
+    string line;       // the current entry line, without the newline
+    bool done = false; // true once all lines were read
+};
 
-    // get the last modification date
-    time_t tt = to_time_t(entry.last_write_time());
-    tm *gmt = gmtime(&tt);
-    char date[80];
-    strftime(date, sizeof(date), "%Y-%m-%d %H:%M:%S", gmt);
-    line += date;
-    line += "\t";
+// the path of an entry line
+// line: the line
+string_view linePath(string_view line)
+{
+    return line.substr(0, line.find('\t'));
+}
 
-    // only compute the message digest of files
-    if (!entry.is_directory())
+// read the next entry line of a run file or verification file (empty lines are skipped)
+// reader: the file
+// returns false at the end of the file
+bool nextEntryLine(RunReader &reader)
+{
+    while (getline(reader.file, reader.line))
     {
-        // get the computed message digest of the file (using the hash function specified by the user)
-        line += hashFile(entry.path(), hashF);
+        if (!reader.line.empty())
+        {
+            return true;
+        }
     }
-    else
+    reader.done = true;
+    return false;
+}
+
+// check that the entries of a verification file are in path order, which files written before
+// they were sorted may not be
+// vFilePath: the path to the verification file
+// offset: the position of the first entry (after the header)
+bool sortedByPath(const string &vFilePath, uint64_t offset)
+{
+    RunReader reader;
+    reader.file.open(vFilePath, ios::in);
+    reader.file.seekg(offset);
+    string previous; // the path of the previous entry
+    while (nextEntryLine(reader))
     {
-        line += "directory";
+        string_view path = linePath(reader.line);
+        if (path < previous)
+        {
+            return false;
+        }
+        previous = path;
     }
-    line += "\n";
+    return true;
+}
 
-    return line;
+// merge run files into one sequence of lines in path order
+// runPaths: the paths of the run files
+// consume: called with each line of the runs, in path order
+void mergeRuns(const vector<string> &runPaths, const function<void(const string &)> &consume)
+{
+    vector<RunReader> runs(runPaths.size());
+    auto later = [&](size_t a, size_t b)
+    {
+        return linePath(runs[a].line) > linePath(runs[b].line);
+    };
+    priority_queue<size_t, vector<size_t>, decltype(later)> heads(later); // the runs by their current line
+    for (size_t r = 0; r < runs.size(); r++)
+    {
+        runs[r].file.open(runPaths[r], ios::in);
+        if (nextEntryLine(runs[r]))
+        {
+            heads.push(r);
+        }
+    }
+    while (!heads.empty())
+    {
+        size_t r = heads.top();
+        heads.pop();
+        consume(runs[r].line);
+        if (nextEntryLine(runs[r]))
+        {
+            heads.push(r);
+        }
+    }
 }
 
-// initialize the monitoring of a directory.
-// dirPath: the path to the directory to be monitored
-// vFilePath: the path to the verification file
-// rFile: the path to the report file
-// hashF: the hash function to be used
-void initialize(string dirPath, string vFilePath, string rFilePath, string hashF)
+// remove the errno of a failed read from a line of a run file, which is written after the 7 fields of the line
+// line: the line, left with its 7 fields
+// returns the errno, 0 if the file was read
+int splitReadError(string_view &line)
 {
-    // start a timer to measure the time of initialization
-    auto start = chrono::high_resolution_clock::now();
+    size_t tabs = count(line.begin(), line.end(), '\t');
+    if (tabs < 7)
+    {
+        return 0;
+    }
+    size_t end = line.rfind('\t');
+    int error = atoi(string(line.substr(end + 1)).c_str());
+    line = line.substr(0, end);
+    return error;
+}
 
-    // make sure that specified directory exists
-    if (!fs::exists(dirPath))
+// write the warnings about the fields of a changed file or directory to the report file, from the lines
+// of the verification file and of a run file.
+// the warnings are the same as those of writeChangedFields
+// rFile: the report file (or a part of it)
+// expected: the line of the verification file
+// actual: the line of the run file
+// legacyTimes: true if the whole-second modification times of the verification file were written one second early
+// returns false if no field differs
+bool writeChangedLine(ostream &rFile, string_view expected, string_view actual, bool legacyTimes)
+{
+    // split the lines into their 7 fields
+    auto split = [](string_view line, string_view fields[7])
     {
-        cout << "The specified of directory does not exist" << endl;
+        int count = 0;
+        for (size_t start = 0; count < 7; count++)
+        {
+            size_t end = line.find('\t', start);
+            fields[count] = line.substr(start, end == string_view::npos ? line.size() - start : end - start);
+            if (end == string_view::npos)
+            {
+                return count == 6;
+            }
+            start = end + 1;
+        }
+        return false;
+    };
+    string_view before[7];
+    string_view after[7];
+    if (!split(expected, before) || !split(actual, after))
+    {
+        cout << "The verification file is corrupted: " << expected << endl;
         exit(EXIT_FAILURE);
     }
 
-    // make sure that the verification file is not inside the monitored directory
-    if (vFilePath.find(dirPath) != string::npos)
+    // the hashes are compared in upper case, as they are written
+    string hash(before[6]);
+    if (hash != "directory")
     {
-        cout << "The path of verification file is inside the monitored directory" << endl;
-        exit(EXIT_FAILURE);
+        transform(hash.begin(), hash.end(), hash.begin(), ::toupper);
     }
-    // make sure that the report file is not inside the monitored directory
-    if (rFilePath.find(dirPath) != string::npos)
+
+    bool changed = false;
+    auto compare = [&](int field, const char *warning, string_view was)
     {
-        cout << "The path of report file is inside the monitored directory" << endl;
-        exit(EXIT_FAILURE);
+        if (was != after[field])
+        {
+            rFile << before[0] << warning << was << " " << after[field] << endl;
+            changed = true;
+        }
+    };
+    compare(1, " file size is different: ", before[1]);
+    compare(2, " owner is different: ", before[2]);
+    compare(3, " group is different: ", before[3]);
+    compare(4, " access rights are different: ", before[4]);
+
+    // the run files do not have the nanoseconds of the modification times, so a legacy time is accepted
+    // if it is one second early, whole second or not
+    time_t was, now;
+    if (legacyTimes && parseTime(before[5], was) && parseTime(after[5], now) && was + 1 == now)
+    {
+        before[5] = after[5];
     }
-    // make sure that the path of verification file is not the same as the path of report file
-    if (vFilePath == rFilePath)
+    compare(5, " last modified time is different: ", before[5]);
+
+    // a file that can not be read has no hash (it is reported on its own)
+    if (!after[6].empty())
     {
-        cout << "The path of verification file is the same as the path of report file" << endl;
-        exit(EXIT_FAILURE);
+        compare(6, " hash is different: ", hash);
     }
+    return changed;
+}
 
-    // make sure that the report file is a text file with .txt extension
-    if (rFilePath.find(".txt") == string::npos)
+// verify a monitored directory whose entries do not fit into the memory budget.
+// the scanned entries are spilled to sorted run files, which are merged with the verification file
+// (which is sorted by path), so that the memory used does not depend on the size of the tree
+// vFilePath: the path to the verification file
+// offset: the position of the first entry in the verification file
+// legacyTimes: true if the whole-second modification times of the verification file were written one second early
+// rFilePath: the path to the report file
+// dirPath: the path to the monitored directory
+// hashF: the hash function of the verification file
+void verifySpilled(const string &vFilePath, uint64_t offset, bool legacyTimes, const string &rFilePath, const string &dirPath, const string &hashF)
+{
+    // the run files are written to a directory of their own in the temporary directory
+    string runDir = (fs::temp_directory_path() / "siv-XXXXXX").string();
+    if (mkdtemp(runDir.data()) == nullptr)
     {
-        cout << "The report file is not a text file with .txt extension" << endl;
+        cout << "The temporary directory for the run files can not be created" << endl;
+        exit(EXIT_FAILURE);
+    }
+    // compared by the components of the canonical paths, so that a relative path, the root directory
+    // or a directory whose name starts with that of the monitored directory are told apart
+    fs::path monitored = fs::weakly_canonical(fs::absolute(dirPath)).lexically_normal();
+    if (!monitored.has_filename())
+    {
+        monitored = monitored.parent_path();
+    }
+    fs::path runPath = fs::weakly_canonical(runDir);
+    if (mismatch(monitored.begin(), monitored.end(), runPath.begin(), runPath.end()).first == monitored.end())
+    {
+        cout << "The temporary directory for the run files is inside the monitored directory" << endl;
+        fs::remove_all(runDir);
         exit(EXIT_FAILURE);
     }
 
-    // create the verification file
-    ofstream vFile;
-    vFile.open(vFilePath, ios::out);
     int fileNum = 0;
     int dirNum = 0;
+    int unreadableNum = 0;
+    WalkState walk;
+    vector<string> runs = spillScan(dirPath, walk, hashF, runDir, fileNum, dirNum, unreadableNum);
+    size_t runCount = runs.size();
 
-    // write the header of the verification file
-    vFile << "SIV Verification File" << endl;
-    vFile << "Directory: " << dirPath << endl;
-    vFile << "Hash Function: " << hashF << endl;
-    vFile << "File Name\tFile Size\tOwner\tGroup\tAccess Rights\tLast Modified\tHash" << endl;
-
-    // read the directory
-    for (const auto &entry : fs::recursive_directory_iterator(dirPath))
+    // merge the runs into larger ones until they can be merged at once
+    while (runs.size() > MAX_MERGED_RUNS)
     {
-        // write the tsv string of the file or directory to the verification file
-        vFile << createTsvString(entry, hashF);
-
-        // count the number of files and directories
-        if (entry.is_directory())
+        vector<string> merged(runs.begin(), runs.begin() + MAX_MERGED_RUNS);
+        runs.erase(runs.begin(), runs.begin() + MAX_MERGED_RUNS);
+        runs.push_back(runDir + "/run" + to_string(runCount++));
+        ofstream run(runs.back(), ios::out);
+        mergeRuns(merged, [&](const string &line)
+                  { run << line << '\n'; });
+        for (const string &path : merged)
         {
-            dirNum++;
+            fs::remove(path);
         }
-        else
+    }
+
+    // merge the runs with the verification file. the warnings are written to files of their own,
+    // so that all deleted, then all new and then all changed entries are reported in path order.
+    // as in verify, the files that can not be read are reported among the changed entries
+    RunReader expected;
+    expected.file.open(vFilePath, ios::in);
+    expected.file.seekg(offset);
+    string previous; // the path of the previous entry of the verification file
+    auto nextExpected = [&]
+    {
+        previous = linePath(expected.line);
+        if (nextEntryLine(expected) && linePath(expected.line) < previous)
         {
-            fileNum++;
+            cout << "The verification file is not sorted by path, verify it without --memory-budget" << endl;
+            fs::remove_all(runDir);
+            exit(EXIT_FAILURE);
         }
+    };
+    nextEntryLine(expected);
+    ofstream deleted(runDir + "/deleted", ios::out);
+    ofstream newFiles(runDir + "/new", ios::out);
+    ofstream changed(runDir + "/changed", ios::out);
+    size_t deletedCount = 0;
+    size_t newCount = 0;
+    size_t changedCount = 0;
+    mergeRuns(runs, [&](const string &runLine)
+              {
+                  string_view line = runLine;
+                  int readError = splitReadError(line);
+                  string_view path = linePath(line);
+                  if (readError != 0)
+                  {
+                      changed << readWarning(path, readError) << endl;
+                  }
+                  for (; !expected.done && linePath(expected.line) < path; nextExpected())
+                  {
+                      deleted << linePath(expected.line) << " is deleted" << endl;
+                      deletedCount++;
+                  }
+                  if (!expected.done && linePath(expected.line) == path)
+                  {
+                      changedCount += line != expected.line && writeChangedLine(changed, expected.line, line, legacyTimes);
+                      nextExpected();
+                  }
+                  else
+                  {
+                      newFiles << path << " is new" << endl;
+                      newCount++;
+                  } });
+    for (; !expected.done; nextExpected())
+    {
+        deleted << linePath(expected.line) << " is deleted" << endl;
+        deletedCount++;
     }
+    deleted.close();
+    newFiles.close();
+    changed.close();
 
-    // create the report file
+    // write the report file
     ofstream rFile;
     rFile.open(rFilePath, ios::out);
     rFile << "SIV Report File" << endl;
     rFile << "Directory: " << dirPath << endl;
     rFile << "Verification File: " << vFilePath << endl;
-    rFile << "Number of parsed Files: " << fileNum << endl;
-    rFile << "Number of parsed Directories: " << dirNum << endl;
     rFile << "Hash Function: " << hashF << endl;
-    string seconds = to_string(chrono::duration_cast<chrono::seconds>(chrono::high_resolution_clock::now() - start).count());
-    rFile << "Time of Initialization (in seconds): " << seconds << endl;
+    rFile << "Number of Parsed Files: " << fileNum << endl;
+    rFile << "Number of Parsed Directories: " << dirNum << endl;
+    rFile << "Scan Order: " << scanOrder() << endl;
+    writeScanReport(rFile);
+    rFile << "Number of Deleted Files: " << deletedCount << endl;
+    rFile << "Number of New Files: " << newCount << endl;
+    rFile << "Number of Changed Files: " << changedCount << endl;
+    rFile << "Number of Unreadable Files: " << unreadableNum << endl;
+    rFile << "Memory Budget: " << scanOptions.memoryBudget << " bytes (" << runCount << " run files of scanned entries merged with the verification file)" << endl;
+    rFile << "Warnings:" << endl;
+    for (const char *part : {"/deleted", "/new", "/changed"})
+    {
+        ifstream warnings(runDir + part, ios::in);
+        if (warnings.peek() != EOF)
+        {
+            rFile << warnings.rdbuf();
+        }
+    }
     rFile.close();
+    fs::remove_all(runDir);
 }
 
 // verify the integrity of a monitored directory against a verification file.
@@ -284,7 +4225,8 @@ void verify(string vFilePath, string rFilePath)
     ifstream vFile;
     vFile.open(vFilePath, ios::in);
     string line;
-    getline(vFile, line); // skip file title line
+    getline(vFile, line); // the file title line tells the format
+    bool legacyTimes = line == LEGACY_FILE_TITLE;
 
     // get the path of the monitored directory
     getline(vFile, line);
@@ -310,6 +4252,12 @@ void verify(string vFilePath, string rFilePath)
         exit(EXIT_FAILURE);
     }
 
+    // make sure that the hash cache file is not inside the monitored directory
+    if (!scanOptions.hashCachePath.empty() && scanOptions.hashCachePath.find(dirPath) != string::npos)
+    {
+        cout << "The path of hash cache file is inside the monitored directory" << endl;
+        exit(EXIT_FAILURE);
+    }
     // make sure that the path of verification file is not the same as the path of report file
     if (vFilePath == rFilePath)
     {
@@ -324,163 +4272,290 @@ void verify(string vFilePath, string rFilePath)
         exit(EXIT_FAILURE);
     }
 
-    int fileNum = 0;
-    int dirNum = 0;
-
-    // read verification file and create a dictionary of tsv strings with file names as keys
-    map<string, string> vFileDict; // key: file name, value: tsv string
-    while (getline(vFile, line))
+    // a verification that would not fit into the memory limit given by the user is made with a memory budget,
+    // unless the verification file is not sorted by path and has to be verified in memory
+    if (scanOptions.maxMemory > 0 && scanOptions.memoryBudget == 0 && fs::file_size(vFilePath) * VERIFY_MEMORY_FACTOR > resources.memoryLimit &&
+        sortedByPath(vFilePath, vFile.tellg()))
     {
-        string fileName = line.substr(0, line.find('\t'));
-        vFileDict[fileName] = line;
+        scanOptions.memoryBudget = resources.memoryLimit / SPILL_BUDGET_SHARE;
     }
 
-    // read the directory and create a dictionary of tsv strings with file names as keys
-    map<string, string> dirFileDict; // key: file name, value: tsv string
-    for (const auto &entry : fs::recursive_directory_iterator(dirPath))
+    // trees larger than the memory are verified from sorted run files
+    if (scanOptions.memoryBudget > 0)
     {
-        string fileName = entry.path().string();
-        string line = createTsvString(entry, hashF);
-        line.erase(remove(line.begin(), line.end(), '\n'), line.end()); // remove the newline character for comparison
-        dirFileDict[fileName] = line;
-        if (entry.is_directory())
-        {
-            dirNum++;
-        }
-        else
-        {
-            fileNum++;
-        }
+        uint64_t offset = vFile.tellg();
+        vFile.close();
+        verifySpilled(vFilePath, offset, legacyTimes, rFilePath, dirPath, hashF);
+        return;
     }
 
-    // compare the two dictionaries and make a list of changed files, deleted files, and new files
-    vector<string> changedFiles;
-    vector<string> deletedFiles;
-    vector<string> newFiles;
-    for (auto it = vFileDict.begin(); it != vFileDict.end(); it++)
-    {
-        string fileName = it->first;
-        string vFileLine = it->second;
+    int fileNum = 0;
+    int dirNum = 0;
 
-        // if the file is in both the verification file and the directory, compare the tsv strings
-        if (dirFileDict.find(fileName) != dirFileDict.end())
-        {
-            string dirFileLine = dirFileDict[fileName];
-            if (vFileLine != dirFileLine)
-            {
-                changedFiles.push_back(fileName);
-            }
-        }
-        else
-        {
-            // if the file is in the verification file but not in the directory, it is deleted
-            deletedFiles.push_back(fileName);
-        }
-    }
+    // read the entries of the verification file into a table while the walk starts.
+    // the walk reuses the listings of the recorded directories once they are loaded,
+    // the entries are compared after the walk (when the loader is joined)
+    EntryTable table;
+    table.digestSize = newHash(hashF)->DigestSize();
+    table.legacyTimes = legacyTimes;
+    table.seed = ((uint64_t)random_device()() << 32) | random_device()();
+    WalkState walk;
+    uint64_t offset = vFile.tellg();
+    vFile.close();
+    vector<uint32_t> order; // the entries in path order
+    PathIndex index;        // the rows of the entries by path
+    double loadSeconds = 0; // time spent loading the verification file
+    double loadWait = 0;    // time the scan waited for the verification file after the walk
+    string loadError;       // reported by the main thread, the loader does not exit while the walk runs
+    walk.knownReady = false;
+    thread loader([&]
+                  {
+                      auto loadStart = chrono::steady_clock::now();
+                      loadError = loadVerificationFile(vFilePath, offset, table);
+                      if (!loadError.empty())
+                      {
+                          return;
+                      }
+                      loadDirectoryRecords(vFilePath, walk);
 
-    // if the file is in the directory but not in the verification file, it is new
-    for (auto it = dirFileDict.begin(); it != dirFileDict.end(); it++)
-    {
-        string fileName = it->first;
-        if (vFileDict.find(fileName) == vFileDict.end())
-        {
-            newFiles.push_back(fileName);
-        }
-    }
+                      // verification files written before they were sorted may be in walk order
+                      order.resize(table.pathEnd.size());
+                      iota(order.begin(), order.end(), 0);
+                      auto pathOrder = [&](uint32_t a, uint32_t b)
+                      {
+                          return tablePath(table, a) < tablePath(table, b);
+                      };
+                      if (!is_sorted(order.begin(), order.end(), pathOrder))
+                      {
+                          stable_sort(order.begin(), order.end(), pathOrder);
+                      }
 
-    vector<string> warnings;
+                      // the entries of the recorded directories are known from the verification file
+                      for (uint32_t i : order)
+                      {
+                          fs::path filePath(tablePath(table, i));
+                          string parent = filePath.parent_path().string();
+                          if (walk.known.count(parent) > 0)
+                          {
+                              walk.knownChildren[parent].push_back(filePath.filename().string());
+                          }
+                      }
+                      walk.knownReady.store(true, memory_order_release);
 
-    // iterate over the list of deleted files and print warnings for each one
-    for (int i = 0; i < deletedFiles.size(); i++)
-    {
-        warnings.push_back(deletedFiles[i] + " is deleted");
-    }
+                      indexPaths(table, index);
+                      loadSeconds = chrono::duration<double>(chrono::steady_clock::now() - loadStart).count(); });
 
-    // iterate over the list of new files and print warnings for each one
-    for (int i = 0; i < newFiles.size(); i++)
-    {
-        warnings.push_back(newFiles[i] + " is new");
-    }
+    // read the directory and compare its entries with the verification file.
+    // the entries are looked up by path: a file is new if the verification file does not have it,
+    // and deleted if the scan did not see it
+    vector<int64_t> rows;    // row of each scanned entry in the table, -1 for new entries
+    vector<uint32_t> owners; // name of the owner of each scanned entry in the table
 
-    // iterate over the list of changed files
-    for (int i = 0; i < changedFiles.size(); i++)
+    // before the files are hashed, their other fields are compared from the cheapest to the most expensive.
+    // a file with a different type, size, access rights, owner or last modified time has changed,
+    // so that its digest is computed last or not at all, depending on --changed-hash.
+    // the ranges of entries are classified in parallel, the owners are looked up before because the
+    // owner cache and the names of the table are not locked
+    uint64_t evaluated[FIELD_COUNT] = {}; // number of entries each field was compared for
+    uint64_t decided = 0;                 // number of entries found to have changed before hashing
+    auto classify = [&](vector<ScanEntry> &scanned)
     {
-        // get the tsv strings of the changed file from the two dictionaries
-        string fileName = changedFiles[i];
-        string vFileLine = vFileDict[fileName];
-        string dirFileLine = dirFileDict[fileName];
-
-        // split the tsv strings by tab
-        vector<string> vFileLineSplit;
-        vector<string> dirFileLineSplit;
-        string temp;
+        auto waitStart = chrono::steady_clock::now();
+        loader.join();
+        loadWait = chrono::duration<double>(chrono::steady_clock::now() - waitStart).count();
+        if (!loadError.empty())
+        {
+            cout << loadError << endl;
+            exit(EXIT_FAILURE);
+        }
 
-        // split the tsv string of the verification file
-        for (int i = 0; i < vFileLine.size(); i++)
+        rows.assign(scanned.size(), -1);
+        owners.resize(scanned.size());
+        for (size_t k = 0; k < scanned.size(); k++)
         {
-            if (vFileLine[i] == '\t')
-            {
-                vFileLineSplit.push_back(temp);
-                temp = "";
-            }
-            else
+            owners[k] = k > 0 && scanned[k].uid == scanned[k - 1].uid ? owners[k - 1] : internName(table, ownerName(scanned[k].uid));
+        }
+        vector<array<uint64_t, FIELD_COUNT + 1>> counts(resources.workers); // evaluated fields and decided entries of each range
+        forEachRange(scanned.size(), [&](size_t first, size_t end, size_t r)
+                     {
+                         for (size_t k = first; k < end; k++)
+                         {
+                             rows[k] = findPath(table, index, scanned[k].path);
+                             scanned[k].changed = rows[k] >= 0 && firstChangedField(table, rows[k], scanned[k], owners[k], counts[r].data()) != FIELD_HASH;
+                             counts[r][FIELD_COUNT] += scanned[k].changed;
+                         } });
+        for (const auto &count : counts)
+        {
+            for (int field = 0; field < FIELD_COUNT; field++)
             {
-                temp += vFileLine[i];
+                evaluated[field] += count[field];
             }
+            decided += count[FIELD_COUNT];
         }
-        vFileLineSplit.push_back(temp);
-        temp = "";
+    };
 
-        // split the tsv string of the directory file
-        for (int i = 0; i < dirFileLine.size(); i++)
+    // the hashed entries are compared range by range while the reorder buffer passes them on in path order.
+    // a range also holds the deleted files whose paths lie between its first entry and the first entry
+    // of the next range, so that the warnings are merged by writing the ranges one after the other
+    struct Partition
+    {
+        string deleted;              // warnings about the deleted files
+        string newFiles;             // warnings about the new files
+        string changed;              // warnings about the changed files
+        size_t deletedCount = 0;     // number of deleted files
+        size_t newCount = 0;         // number of new files
+        size_t changedCount = 0;     // number of changed files
+        size_t unreadableCount = 0;  // number of files that could not be read
+        size_t compared = 0;         // number of entries compared
+        uint64_t hashesCompared = 0; // number of digests compared
+    };
+    vector<ScanEntry> entries;
+    vector<Partition> partitions(1);
+    auto compareRange = [&](size_t r)
+    {
+        Partition &part = partitions[r];
+        size_t first = r * COMPARE_RANGE;
+        size_t end = min(entries.size(), first + COMPARE_RANGE);
+        ostringstream changed;
+        for (size_t k = first; k < end; k++)
         {
-            if (dirFileLine[i] == '\t')
+            const ScanEntry &entry = entries[k];
+            if (entry.readError != 0)
+            {
+                changed << readWarning(entry.path, entry.readError) << endl;
+                part.unreadableCount++;
+            }
+            if (rows[k] >= 0 && markSeen(index, rows[k]))
             {
-                dirFileLineSplit.push_back(temp);
-                temp = "";
+                part.compared++;
+                if (!entry.isDirectory && entry.digestSize > 0)
+                {
+                    part.hashesCompared++;
+                }
+                if (entry.changed || (entry.readError == 0 && !sameDigest(table, rows[k], entry)))
+                {
+                    writeChangedFields(changed, table, rows[k], entry, owners[k]);
+                    part.changedCount++;
+                }
             }
             else
             {
-                temp += dirFileLine[i];
+                part.newFiles += entry.path + " is new\n";
+                part.newCount++;
             }
         }
-        dirFileLineSplit.push_back(temp);
-
-        // compare the file size, owner, group, access rights, and last modified time and hash of the file
+        part.changed = changed.str();
 
-        // compare the file size
-        if (vFileLineSplit[1] != dirFileLineSplit[1])
+        // the entries of the table in the paths of the range can only have been seen by the range
+        auto bound = [&](size_t k)
         {
-            warnings.push_back(fileName + " file size is different: " + vFileLineSplit[1] + " " + dirFileLineSplit[1]);
-        }
-        // compare the owner, group, access rights, and last modified time
-        if (vFileLineSplit[2] != dirFileLineSplit[2])
+            return lower_bound(order.begin(), order.end(), entries[k].path, [&](uint32_t i, const string &path)
+                               { return tablePath(table, i) < path; });
+        };
+        auto row = r == 0 ? order.begin() : bound(first);
+        auto rowEnd = end == entries.size() ? order.end() : bound(end);
+        for (; row != rowEnd; row++)
         {
-            warnings.push_back(fileName + " owner is different: " + vFileLineSplit[2] + " " + dirFileLineSplit[2]);
+            if (!index.seen[*row].load(memory_order_relaxed))
+            {
+                part.deleted.append(tablePath(table, *row)).append(" is deleted\n");
+                part.deletedCount++;
+            }
         }
+    };
 
-        // compare the group
-        if (vFileLineSplit[3] != dirFileLineSplit[3])
+    // the comparing threads take the ranges whose entries were all passed on
+    mutex compareLock;
+    condition_variable compareReady;
+    deque<size_t> readyRanges;
+    bool hashed = false; // true when all ranges are ready
+    vector<thread> comparers;
+    for (unsigned t = 0; t < resources.workers; t++)
+    {
+        comparers.emplace_back([&]
+                               {
+                                   unique_lock<mutex> guard(compareLock);
+                                   while (true)
+                                   {
+                                       compareReady.wait(guard, [&]
+                                                         { return !readyRanges.empty() || hashed; });
+                                       if (readyRanges.empty())
+                                       {
+                                           return;
+                                       }
+                                       size_t r = readyRanges.front();
+                                       readyRanges.pop_front();
+                                       guard.unlock();
+                                       compareRange(r);
+                                       guard.lock();
+                                   } });
+    }
+    auto rangeReady = [&](size_t r)
+    {
         {
-            warnings.push_back(fileName + " group is different: " + vFileLineSplit[3] + " " + dirFileLineSplit[3]);
+            lock_guard<mutex> guard(compareLock);
+            readyRanges.push_back(r);
         }
-
-        // compare the access rights
-        if (vFileLineSplit[4] != dirFileLineSplit[4])
+        compareReady.notify_one();
+    };
+    // the entries are compared without their lines
+    reorder.withLines = false;
+    reorder.sink = [&](const ScanEntry &entry, const string &)
+    {
+        size_t k = &entry - entries.data();
+        if ((k + 1) % COMPARE_RANGE == 0 || k + 1 == entries.size())
         {
-            warnings.push_back(fileName + " access rights are different: " + vFileLineSplit[4] + " " + dirFileLineSplit[4]);
+            rangeReady(k / COMPARE_RANGE);
         }
+    };
+    auto classifyAndSplit = [&](vector<ScanEntry> &scanned)
+    {
+        classify(scanned);
+        partitions.resize(max<size_t>(1, (scanned.size() + COMPARE_RANGE - 1) / COMPARE_RANGE));
+    };
+    scanDirectory(dirPath, entries, walk, hashF, classifyAndSplit);
+
+    // without entries, the only range holds all deleted files
+    if (entries.empty())
+    {
+        rangeReady(0);
+    }
+    {
+        lock_guard<mutex> guard(compareLock);
+        hashed = true;
+    }
+    compareReady.notify_all();
+    for (auto &t : comparers)
+    {
+        t.join();
+    }
+    reorder.sink = nullptr;
+    reorder.withLines = true;
+
+    size_t deletedCount = 0;
+    size_t newCount = 0;
+    size_t changedCount = 0;
+    size_t unreadableCount = 0;
+    size_t compared = 0; // number of entries compared
+    for (const auto &part : partitions)
+    {
+        deletedCount += part.deletedCount;
+        newCount += part.newCount;
+        changedCount += part.changedCount;
+        unreadableCount += part.unreadableCount;
+        compared += part.compared;
+        evaluated[FIELD_HASH] += part.hashesCompared;
+    }
 
-        // compare the last modified time
-        if (vFileLineSplit[5] != dirFileLineSplit[5])
+    for (const auto &entry : entries)
+    {
+        if (entry.isDirectory)
         {
-            warnings.push_back(fileName + " last modified time is different: " + vFileLineSplit[5] + " " + dirFileLineSplit[5]);
+            dirNum++;
         }
-
-        // compare the hash
-        if (vFileLineSplit[6] != dirFileLineSplit[6])
+        else
         {
-            warnings.push_back(fileName + " hash is different: " + vFileLineSplit[6] + " " + dirFileLineSplit[6]);
+            fileNum++;
         }
     }
 
@@ -493,13 +4568,36 @@ void verify(string vFilePath, string rFilePath)
     rFile << "Hash Function: " << hashF << endl;
     rFile << "Number of Parsed Files: " << fileNum << endl;
     rFile << "Number of Parsed Directories: " << dirNum << endl;
-    rFile << "Number of Deleted Files: " << deletedFiles.size() << endl;
-    rFile << "Number of New Files: " << newFiles.size() << endl;
-    rFile << "Number of Changed Files: " << changedFiles.size() << endl;
+    rFile << "Scan Order: " << scanOrder() << endl;
+    writeScanReport(rFile);
+    rFile << "Number of Deleted Files: " << deletedCount << endl;
+    rFile << "Number of New Files: " << newCount << endl;
+    rFile << "Number of Changed Files: " << changedCount << endl;
+    rFile << "Number of Unreadable Files: " << unreadableCount << endl;
+    rFile << "Entries Compared: " << compared << " (" << compared - changedCount << " unchanged)" << endl;
+    rFile << "Entries Changed Before Hashing: " << decided << " (hashes of changed files: " << scanOptions.changedHash << ")" << endl;
+    rFile << "Fields Evaluated:";
+    for (int field = 0; field < FIELD_COUNT; field++)
+    {
+        rFile << (field > 0 ? ", " : " ") << COMPARE_FIELD_NAMES[field] << " " << evaluated[field];
+    }
+    rFile << endl;
+    rFile << "Verification File Loaded In (in seconds): " << loadSeconds << " (" << loadWait << " waited for after the walk)" << endl;
+    rFile << "Number of Directories Not Listed (unchanged since initialization): " << walk.reused << endl;
     rFile << "Warnings:" << endl;
-    for (int i = 0; i < warnings.size(); i++)
+
+    // the deleted files, the new files and the fields of the changed files that differ
+    for (const auto &part : partitions)
+    {
+        rFile << part.deleted;
+    }
+    for (const auto &part : partitions)
+    {
+        rFile << part.newFiles;
+    }
+    for (const auto &part : partitions)
     {
-        rFile << warnings[i] << endl;
+        rFile << part.changed;
     }
     rFile.close();
 }
@@ -519,8 +4617,32 @@ int main(int argc, char *argv[])
     hashF = "";
     mode = 0;
 
+    // long form of the scan options
+    static struct option longOptions[] = {
+        {"inode-order", no_argument, nullptr, OPT_INODE_ORDER},
+        {"hash-cache", required_argument, nullptr, OPT_HASH_CACHE},
+        {"hash-cache-size", required_argument, nullptr, OPT_HASH_CACHE_SIZE},
+        {"jobs", required_argument, nullptr, OPT_JOBS},
+        {"background", no_argument, nullptr, OPT_BACKGROUND},
+        {"max-pressure", required_argument, nullptr, OPT_MAX_PRESSURE},
+        {"max-read-rate", required_argument, nullptr, OPT_MAX_READ_RATE},
+        {"max-cpu", required_argument, nullptr, OPT_MAX_CPU},
+        {"idle-io", no_argument, nullptr, OPT_IDLE_IO},
+        {"page-cache", required_argument, nullptr, OPT_PAGE_CACHE},
+        {"cache-first", no_argument, nullptr, OPT_CACHE_FIRST},
+        {"prefetch", required_argument, nullptr, OPT_PREFETCH},
+        {"device-readers", required_argument, nullptr, OPT_DEVICE_READERS},
+        {"autotune", no_argument, nullptr, OPT_AUTOTUNE},
+        {"largest-first", no_argument, nullptr, OPT_LARGEST_FIRST},
+        {"reorder-buffer", required_argument, nullptr, OPT_REORDER_BUFFER},
+        {"async", required_argument, nullptr, OPT_ASYNC},
+        {"changed-hash", required_argument, nullptr, OPT_CHANGED_HASH},
+        {"memory-budget", required_argument, nullptr, OPT_MEMORY_BUDGET},
+        {"max-memory", required_argument, nullptr, OPT_MAX_MEMORY},
+        {nullptr, 0, nullptr, 0}};
+
     // parse command line arguments
-    while ((opt = getopt(argc, argv, "ivhD:V:R:H:")) != -1)
+    while ((opt = getopt_long(argc, argv, "ivhD:V:R:H:", longOptions, nullptr)) != -1)
     {
         switch (opt)
         {
@@ -545,6 +4667,131 @@ int main(int argc, char *argv[])
         case 'H':
             hashF = optarg;
             break;
+        case OPT_INODE_ORDER:
+            scanOptions.inodeOrder = true;
+            break;
+        case OPT_HASH_CACHE:
+            scanOptions.hashCachePath = optarg;
+            break;
+        case OPT_HASH_CACHE_SIZE:
+            scanOptions.hashCacheSize = parseSize(optarg);
+            if (scanOptions.hashCacheSize == 0)
+            {
+                cout << "Please specify a valid hash cache size. Consult -h for more info" << endl;
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case OPT_JOBS:
+            if (atoi(optarg) <= 0)
+            {
+                cout << "Please specify a valid number of jobs. Consult -h for more info" << endl;
+                exit(EXIT_FAILURE);
+            }
+            scanOptions.jobs = atoi(optarg);
+            break;
+        case OPT_BACKGROUND:
+            scanOptions.background = true;
+            break;
+        case OPT_MAX_PRESSURE:
+            scanOptions.maxPressure = atof(optarg);
+            if (scanOptions.maxPressure <= 0)
+            {
+                cout << "Please specify a valid maximum pressure. Consult -h for more info" << endl;
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case OPT_MAX_READ_RATE:
+            scanOptions.maxReadRate = parseSize(optarg);
+            if (scanOptions.maxReadRate == 0)
+            {
+                cout << "Please specify a valid maximum read rate. Consult -h for more info" << endl;
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case OPT_MAX_CPU:
+            scanOptions.maxCpu = atof(optarg);
+            if (scanOptions.maxCpu <= 0)
+            {
+                cout << "Please specify a valid cpu budget. Consult -h for more info" << endl;
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case OPT_IDLE_IO:
+            scanOptions.idleIo = true;
+            break;
+        case OPT_PAGE_CACHE:
+            scanOptions.pageCache = optarg;
+            if (scanOptions.pageCache != "keep" && scanOptions.pageCache != "drop" && scanOptions.pageCache != "direct")
+            {
+                cout << "Please specify a valid page cache mode. Consult -h for more info" << endl;
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case OPT_CACHE_FIRST:
+            scanOptions.cacheFirst = true;
+            break;
+        case OPT_PREFETCH:
+            scanOptions.prefetch = string(optarg) == "auto" ? -1 : atoi(optarg);
+            if (scanOptions.prefetch == 0 || scanOptions.prefetch < -1 || (scanOptions.prefetch == -1 && string(optarg) != "auto"))
+            {
+                cout << "Please specify a valid number of files to prefetch. Consult -h for more info" << endl;
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case OPT_DEVICE_READERS:
+            if (atoi(optarg) <= 0)
+            {
+                cout << "Please specify a valid number of device readers. Consult -h for more info" << endl;
+                exit(EXIT_FAILURE);
+            }
+            scanOptions.deviceReaders = atoi(optarg);
+            break;
+        case OPT_AUTOTUNE:
+            scanOptions.autotune = true;
+            break;
+        case OPT_LARGEST_FIRST:
+            scanOptions.largestFirst = true;
+            break;
+        case OPT_REORDER_BUFFER:
+            scanOptions.reorderBuffer = parseSize(optarg);
+            if (scanOptions.reorderBuffer == 0)
+            {
+                cout << "Please specify a valid reorder buffer size. Consult -h for more info" << endl;
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case OPT_ASYNC:
+            if (atoi(optarg) <= 0)
+            {
+                cout << "Please specify a valid number of files in flight. Consult -h for more info" << endl;
+                exit(EXIT_FAILURE);
+            }
+            scanOptions.async = atoi(optarg);
+            break;
+        case OPT_CHANGED_HASH:
+            scanOptions.changedHash = optarg;
+            if (scanOptions.changedHash != "compute" && scanOptions.changedHash != "defer" && scanOptions.changedHash != "skip")
+            {
+                cout << "Please specify a valid changed hash policy. Consult -h for more info" << endl;
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case OPT_MEMORY_BUDGET:
+            scanOptions.memoryBudget = parseSize(optarg);
+            if (scanOptions.memoryBudget == 0)
+            {
+                cout << "Please specify a valid memory budget. Consult -h for more info" << endl;
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case OPT_MAX_MEMORY:
+            scanOptions.maxMemory = parseSize(optarg);
+            if (scanOptions.maxMemory == 0)
+            {
+                cout << "Please specify a valid maximum memory. Consult -h for more info" << endl;
+                exit(EXIT_FAILURE);
+            }
+            break;
         default:
             cout << "Invalid command line argument" << endl;
             exit(EXIT_FAILURE);
@@ -621,6 +4868,24 @@ int main(int argc, char *argv[])
         exit(EXIT_SUCCESS);
     }
 
+    // size the thread pool and buffers to the cpu and memory limits
+    detectResources();
+
+    // the cold files of a cache first scan are prefetched with an automatically tuned depth by default
+    if (scanOptions.cacheFirst && scanOptions.prefetch == 0)
+    {
+        scanOptions.prefetch = -1;
+    }
+
+    // enforce the read rate and cpu budget, and set the io priority class (inherited by the hashing threads)
+    startBucket(readBucket, scanOptions.maxReadRate);
+    startBucket(cpuBucket, scanOptions.maxCpu);
+    if (scanOptions.idleIo && syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, IOPRIO_PRIO_VALUE(IOPRIO_CLASS_IDLE, 0)) != 0)
+    {
+        cout << "The idle io priority class can not be set" << endl;
+        exit(EXIT_FAILURE);
+    }
+
     // Initialization mode
     if (mode == 1)
     {